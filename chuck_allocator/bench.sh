@@ -0,0 +1,10 @@
+#!/bin/bash
+
+set -e
+
+g++ -std=c++17 -O2 -pthread -I./src bench/threads.cpp -o chunk_allocator_threads
+g++ -std=c++17 -O2 -pthread -I./src bench/suite.cpp -o chunk_allocator_suite
+./chunk_allocator_threads "$@"
+./chunk_allocator_suite "$@"
+
+rm chunk_allocator_threads chunk_allocator_suite
@@ -0,0 +1,437 @@
+// Allocation patterns driven through chunk_allocator, object_pool,
+// std::allocator and a bump allocator. Every workload is timed in batches
+// of operations; the table shows the throughput, percentiles of the
+// per-operation latency of the batches and the peak resident set size of
+// the workload.
+//
+// Usage: chunk_allocator_suite [operations per workload]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/chunk_allocator.h"
+#include "../src/object_pool.h"
+
+namespace {
+
+const size_t kBatch = 256;
+
+struct Arena {
+  std::vector<std::unique_ptr<uint8_t[]>> blocks;
+  uint8_t* top = nullptr;
+  uint8_t* end = nullptr;
+};
+
+// Never frees, the lower bound for any allocator
+template <typename T>
+class BumpAllocator {
+  template <typename U>
+  friend class BumpAllocator;
+
+  std::shared_ptr<Arena> arena_;
+
+ public:
+  using value_type = T;
+
+  BumpAllocator() : arena_(std::make_shared<Arena>()) {}
+
+  template <typename U>
+  BumpAllocator(const BumpAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t n) {
+    size_t bytes = (n * sizeof(T) + 15) / 16 * 16;
+    if (static_cast<size_t>(arena_->end - arena_->top) < bytes) {
+      size_t size = std::max<size_t>(1 << 20, bytes);
+      arena_->blocks.emplace_back(new uint8_t[size]);
+      arena_->top = arena_->blocks.back().get();
+      arena_->end = arena_->top + size;
+    }
+    uint8_t* result = arena_->top;
+    arena_->top += bytes;
+    return reinterpret_cast<T*>(result);
+  }
+
+  void deallocate(T*, size_t) {}
+
+  template <typename U>
+  bool operator==(const BumpAllocator<U>& other) const {
+    return arena_ == other.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const BumpAllocator<U>& other) const {
+    return arena_ != other.arena_;
+  }
+};
+
+struct StdKind {
+  static constexpr const char* kName = "std::allocator";
+  static constexpr bool kConcurrent = true;
+  std::allocator<uint8_t> Make() const { return {}; }
+};
+
+struct ChunkKind {
+  static constexpr const char* kName = "chunk_allocator";
+  static constexpr bool kConcurrent = false;
+  chunk_allocator<uint8_t> Make() const { return {}; }
+};
+
+struct ConcurrentChunkKind {
+  static constexpr const char* kName = "chunk (concurrent)";
+  static constexpr bool kConcurrent = true;
+  chunk_allocator<uint8_t> Make() const {
+    chunk_options options;
+    options.concurrent = true;
+    return chunk_allocator<uint8_t>(options);
+  }
+};
+
+struct ObjectPoolKind {
+  static constexpr const char* kName = "object_pool";
+  static constexpr bool kConcurrent = false;
+  object_pool<uint8_t> Make() const { return {}; }
+};
+
+struct BumpKind {
+  static constexpr const char* kName = "bump";
+  static constexpr bool kConcurrent = false;
+  BumpAllocator<uint8_t> Make() const { return {}; }
+};
+
+// Peak resident set size since the last Reset, in MiB; Linux only
+class PeakRss {
+ public:
+  static void Reset() {
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+  }
+
+  static double Read() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+      if (line.compare(0, 6, "VmHWM:") == 0) {
+        return std::stod(line.substr(6)) / 1024;
+      }
+    }
+    return 0;
+  }
+};
+
+class Recorder {
+ public:
+  // time ops operations done by f as one sample
+  template <typename F>
+  void Batch(size_t ops, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples_.push_back(elapsed.count() / ops);
+    total_ += elapsed.count();
+    ops_ += ops;
+  }
+
+  // take the samples and operations of a recorder of another thread;
+  // the time they took together is set with SetWallTime
+  void Merge(const Recorder& other) {
+    samples_.insert(samples_.end(), other.samples_.begin(),
+                    other.samples_.end());
+    ops_ += other.ops_;
+  }
+
+  // wall time of a run made by several threads, in nanoseconds
+  void SetWallTime(double nanoseconds) { total_ = nanoseconds; }
+
+  double Throughput() const { return ops_ / total_ * 1e3; }
+
+  double Percentile(double q) {
+    if (samples_.empty()) {
+      return 0;
+    }
+    size_t index = std::min(samples_.size() - 1,
+                            static_cast<size_t>(q * samples_.size()));
+    std::nth_element(samples_.begin(), samples_.begin() + index,
+                     samples_.end());
+    return samples_[index];
+  }
+
+ private:
+  std::vector<double> samples_;
+  double total_ = 0;
+  size_t ops_ = 0;
+};
+
+struct Block {
+  uint8_t* ptr;
+  size_t size;
+};
+
+// Allocate kBatch blocks of 32 bytes, then free them newest first
+template <typename A>
+void Lifo(A alloc, size_t ops, Recorder& recorder) {
+  std::vector<uint8_t*> blocks(kBatch);
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (auto& block : blocks) {
+        block = alloc.allocate(32);
+      }
+      for (size_t i = kBatch; i-- > 0;) {
+        alloc.deallocate(blocks[i], 32);
+      }
+    });
+  }
+}
+
+// Keep a queue of 32-byte blocks, free the oldest for every new one
+template <typename A>
+void Fifo(A alloc, size_t ops, Recorder& recorder) {
+  std::deque<uint8_t*> queue;
+  for (size_t i = 0; i < kBatch * 4; ++i) {
+    queue.push_back(alloc.allocate(32));
+  }
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (size_t i = 0; i < kBatch; ++i) {
+        queue.push_back(alloc.allocate(32));
+        alloc.deallocate(queue.front(), 32);
+        queue.pop_front();
+      }
+    });
+  }
+  for (uint8_t* block : queue) {
+    alloc.deallocate(block, 32);
+  }
+}
+
+// Allocate kBatch blocks of 32 bytes, then free them in random order
+template <typename A>
+void RandomOrder(A alloc, size_t ops, Recorder& recorder) {
+  std::mt19937 rand(1);
+  std::vector<uint8_t*> blocks(kBatch);
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (auto& block : blocks) {
+        block = alloc.allocate(32);
+      }
+      std::shuffle(blocks.begin(), blocks.end(), rand);
+      for (uint8_t* block : blocks) {
+        alloc.deallocate(block, 32);
+      }
+    });
+  }
+}
+
+// Replace random blocks of a window with new ones of 8 to 512 bytes
+template <typename A>
+void MixedSizes(A alloc, size_t ops, Recorder& recorder) {
+  std::mt19937 rand(2);
+  std::vector<Block> window(4096, Block{nullptr, 0});
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (size_t i = 0; i < kBatch; ++i) {
+        Block& block = window[rand() % window.size()];
+        if (block.ptr != nullptr) {
+          alloc.deallocate(block.ptr, block.size);
+        }
+        block.size = 8 + rand() % 505;
+        block.ptr = alloc.allocate(block.size);
+      }
+    });
+  }
+  for (Block& block : window) {
+    if (block.ptr != nullptr) {
+      alloc.deallocate(block.ptr, block.size);
+    }
+  }
+}
+
+template <typename A, typename T>
+using Rebind = typename std::allocator_traits<A>::template rebind_alloc<T>;
+
+// Push to the back and pop from the front of a list of 1024 elements
+template <typename A>
+void ListWorkload(A alloc, size_t ops, Recorder& recorder) {
+  std::list<int, Rebind<A, int>> list(alloc);
+  for (int i = 0; i < 1024; ++i) {
+    list.push_back(i);
+  }
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (size_t i = 0; i < kBatch; ++i) {
+        list.push_back(i);
+        list.pop_front();
+      }
+    });
+  }
+}
+
+// Insert and erase random keys of a map of about 4096 elements
+template <typename A>
+void MapWorkload(A alloc, size_t ops, Recorder& recorder) {
+  using Map = std::map<int, int, std::less<int>,
+                       Rebind<A, std::pair<const int, int>>>;
+  Map map{std::less<int>(), alloc};
+  std::mt19937 rand(3);
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      for (size_t i = 0; i < kBatch; ++i) {
+        int key = rand() % 8192;
+        auto it = map.find(key);
+        if (it == map.end()) {
+          map.emplace(key, key);
+        } else {
+          map.erase(it);
+        }
+      }
+    });
+  }
+}
+
+// Grow vectors of random length by push_back and drop them
+template <typename A>
+void VectorWorkload(A alloc, size_t ops, Recorder& recorder) {
+  std::mt19937 rand(4);
+  for (size_t done = 0; done < ops; done += kBatch) {
+    recorder.Batch(kBatch, [&] {
+      std::vector<int, Rebind<A, int>> vec(alloc);
+      size_t length = kBatch / 2 + rand() % kBatch;
+      for (size_t i = 0; i < length; ++i) {
+        vec.push_back(i);
+      }
+    });
+  }
+}
+
+// Producers allocate 64-byte blocks and hand them over in batches to
+// consumers that free them, so every block is freed by another thread
+template <typename A>
+void ProducerConsumer(A alloc, size_t ops, Recorder& recorder) {
+  const size_t pairs =
+      std::max<size_t>(1, std::thread::hardware_concurrency() / 2);
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::vector<uint8_t*>> queue;
+  size_t producing = pairs;
+
+  std::vector<Recorder> recorders(2 * pairs);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t p = 0; p < pairs; ++p) {
+    threads.emplace_back([&, p] {
+      A local(alloc);
+      for (size_t done = 0; done < ops / pairs; done += kBatch) {
+        std::vector<uint8_t*> blocks(kBatch);
+        recorders[p].Batch(kBatch, [&] {
+          for (auto& block : blocks) {
+            block = local.allocate(64);
+          }
+        });
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(blocks));
+        ready.notify_one();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      --producing;
+      ready.notify_all();
+    });
+    threads.emplace_back([&, p] {
+      A local(alloc);
+      for (;;) {
+        std::vector<uint8_t*> blocks;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          ready.wait(lock, [&] { return !queue.empty() || producing == 0; });
+          if (queue.empty()) {
+            return;
+          }
+          blocks = std::move(queue.front());
+          queue.pop_front();
+        }
+        recorders[pairs + p].Batch(kBatch, [&] {
+          for (uint8_t* block : blocks) {
+            local.deallocate(block, 64);
+          }
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  for (const Recorder& other : recorders) {
+    recorder.Merge(other);
+  }
+  recorder.SetWallTime(elapsed.count());
+}
+
+template <typename Kind, typename Workload>
+void Measure(const char* workload, Workload run, size_t ops) {
+  Recorder recorder;
+  PeakRss::Reset();
+  run(Kind().Make(), ops, recorder);
+  double rss = PeakRss::Read();
+
+  std::cout << std::left << std::setw(18) << workload << std::setw(20)
+            << Kind::kName << std::right << std::fixed << std::setprecision(1)
+            << std::setw(9) << recorder.Throughput() << std::setw(9)
+            << recorder.Percentile(0.5) << std::setw(9)
+            << recorder.Percentile(0.99) << std::setw(9)
+            << recorder.Percentile(0.999) << std::setw(10) << rss << '\n';
+}
+
+template <typename Kind>
+void MeasureAll(size_t ops) {
+  Measure<Kind>("lifo", Lifo<decltype(Kind().Make())>, ops);
+  Measure<Kind>("fifo", Fifo<decltype(Kind().Make())>, ops);
+  Measure<Kind>("random order", RandomOrder<decltype(Kind().Make())>, ops);
+  Measure<Kind>("mixed sizes", MixedSizes<decltype(Kind().Make())>, ops);
+  Measure<Kind>("std::list", ListWorkload<decltype(Kind().Make())>, ops);
+  Measure<Kind>("std::map", MapWorkload<decltype(Kind().Make())>, ops);
+  Measure<Kind>("std::vector", VectorWorkload<decltype(Kind().Make())>, ops);
+  if (Kind::kConcurrent) {
+    Measure<Kind>("producer/consumer",
+                  ProducerConsumer<decltype(Kind().Make())>, ops);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t ops = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+  std::cout << "Latency in ns per operation over batches of " << kBatch
+            << " operations, peak RSS of the process\n";
+  std::cout << std::left << std::setw(18) << "workload" << std::setw(20)
+            << "allocator" << std::right << std::setw(9) << "Mops/s"
+            << std::setw(9) << "p50" << std::setw(9) << "p99" << std::setw(9)
+            << "p99.9" << std::setw(10) << "RSS MiB" << '\n';
+  MeasureAll<StdKind>(ops);
+  MeasureAll<ChunkKind>(ops);
+  MeasureAll<ConcurrentChunkKind>(ops);
+  // only node containers allocate single objects the pool has slots for
+  Measure<ObjectPoolKind>(
+      "std::list", ListWorkload<decltype(ObjectPoolKind().Make())>, ops);
+  Measure<ObjectPoolKind>(
+      "std::map", MapWorkload<decltype(ObjectPoolKind().Make())>, ops);
+  MeasureAll<BumpKind>(ops);
+  return 0;
+}
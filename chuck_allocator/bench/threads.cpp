@@ -0,0 +1,119 @@
+// Multithreaded allocate/free benchmark: every thread keeps a window of
+// live blocks of random small sizes, replacing a random one at each step,
+// and hands a part of its blocks to the next thread to free.
+//
+// Usage: chunk_allocator_threads [operations per thread]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../src/chunk_allocator.h"
+
+namespace {
+
+const size_t kWindow = 1024;
+
+struct Malloc {
+  uint8_t* allocate(size_t n) { return static_cast<uint8_t*>(std::malloc(n)); }
+  void deallocate(uint8_t* ptr, size_t) { std::free(ptr); }
+};
+
+// The single-threaded allocator behind one lock, what users had to do before
+struct Locked {
+  chunk_allocator<uint8_t> allocator;
+  std::mutex mutex;
+
+  uint8_t* allocate(size_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocator.allocate(n);
+  }
+  void deallocate(uint8_t* ptr, size_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    allocator.deallocate(ptr, n);
+  }
+};
+
+struct Concurrent {
+  chunk_allocator<uint8_t> allocator{chunk_options{true}};
+
+  uint8_t* allocate(size_t n) { return allocator.allocate(n); }
+  void deallocate(uint8_t* ptr, size_t n) { allocator.deallocate(ptr, n); }
+};
+
+struct Block {
+  uint8_t* ptr = nullptr;
+  size_t size = 0;
+};
+
+template <class Allocator>
+double Run(size_t threads, size_t operations) {
+  Allocator allocator;
+  std::vector<std::vector<Block>> handed(threads);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::mt19937 rand(t);
+      std::vector<Block> window(kWindow);
+      for (size_t i = 0; i < operations; ++i) {
+        Block& block = window[rand() % kWindow];
+        if (block.ptr != nullptr) {
+          allocator.deallocate(block.ptr, block.size);
+        }
+        block.size = 8 + rand() % 121;
+        block.ptr = allocator.allocate(block.size);
+        block.ptr[0] = 1;
+      }
+      handed[t] = std::move(window);
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  workers.clear();
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      for (Block& block : handed[(t + 1) % threads]) {
+        if (block.ptr != nullptr) {
+          allocator.deallocate(block.ptr, block.size);
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return threads * operations / elapsed.count() / 1e6;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t operations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::cout << "Millions of allocate/free pairs per second\n";
+  std::cout << std::setw(8) << "threads" << std::setw(14) << "malloc"
+            << std::setw(14) << "concurrent" << std::setw(14) << "locked"
+            << '\n';
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2)
+              << std::setw(14) << Run<Malloc>(threads, operations)
+              << std::setw(14) << Run<Concurrent>(threads, operations)
+              << std::setw(14) << Run<Locked>(threads, operations) << '\n';
+  }
+  return 0;
+}
@@ -2,7 +2,11 @@
 
 set -e
 
-g++ -std=c++17 -I./src test/test.cpp -o chunk_allocator_test
+g++ -std=c++17 -pthread -I./src test/test.cpp -o chunk_allocator_test
 ./chunk_allocator_test
 
-echo Test complete!
\ No newline at end of file
+g++ -std=c++17 -pthread -DCHUNK_ALLOCATOR_DEBUG -I./src test/debug.cpp \
+    -o chunk_allocator_debug_test
+./chunk_allocator_debug_test
+
+echo Test complete!
@@ -1,153 +1,1724 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 #include <stdexcept>
 
-template <typename T>
-struct chunk_allocator {
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define CHUNK_ALLOCATOR_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define CHUNK_ALLOCATOR_ASAN
+#endif
+#endif
+
+#ifdef CHUNK_ALLOCATOR_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+
+namespace chunk_detail {
+
+// all requests are rounded up to whole granules
+constexpr size_t granule = 8;
+
+// requests up to this size are served from the size-class free lists
+constexpr size_t max_small_size = 128;
+constexpr size_t small_classes = max_small_size / granule;
+
+// how many freed blocks every size-class free list keeps
+constexpr size_t class_depth = 32;
+
+// concurrent pools split their chunks between up to this many shards
+constexpr size_t max_shards = 8;
+
+// size of the first chunk of a pool unless the options say otherwise
+constexpr size_t default_chunk_size = 1 << 12;
+
+// chunks stop growing at this size unless the options say otherwise,
+// larger requests get dedicated chunks
+constexpr size_t default_max_chunk_size = 1 << 20;
+
+// chunks backed by huge pages are multiples of this size
+constexpr size_t huge_page_size = 1 << 21;
+
+// blocks of this size or less with no extra alignment go to the size-class
+// free lists and thread caches when freed
+inline bool cacheable(size_t n, size_t alignment) {
+  return n <= max_small_size && alignment <= granule;
+}
+
+inline size_t floor_log2(size_t n) { return 63 - __builtin_clzll(n); }
+
+// free runs of granules are indexed by their length: runs shorter than
+// four granules get a class per length, longer ones a class per quarter
+// of every doubling, so classes of runs up to 2^31 granules fit in 128
+constexpr size_t run_classes = 128;
+
+// regular chunks are capped so that their runs fit these classes
+constexpr size_t max_regular_size = size_t(1) << 34;
+
+inline size_t run_class(size_t n) {
+  if (n < 4) {
+    return n;
+  }
+  size_t k = floor_log2(n);
+  return 4 * (k - 1) + ((n >> (k - 2)) & 3);
+}
+
+// length of the shortest run of class c
+inline size_t class_floor(size_t c) {
+  return c < 4 ? c : (4 + c % 4) << (c / 4 - 1);
+}
+
+// lowest class every run of which is at least n granules long
+inline size_t fitting_class(size_t n) {
+  size_t c = run_class(n);
+  return class_floor(c) == n ? c : c + 1;
+}
+
+// set of run classes, the nearest member is found with a bit scan
+class class_set {
+  uint64_t words_[2] = {};
+
+ public:
+  void insert(size_t c) { words_[c / 64] |= uint64_t(1) << (c % 64); }
+  void erase(size_t c) { words_[c / 64] &= ~(uint64_t(1) << (c % 64)); }
+  void clear() { words_[0] = words_[1] = 0; }
+
+  // lowest member not below c, or run_classes if there is none
+  size_t lower_bound(size_t c) const {
+    for (size_t i = c / 64; i < 2; ++i) {
+      uint64_t word = words_[i];
+      if (i == c / 64) {
+        word &= ~uint64_t(0) << (c % 64);
+      }
+      if (word != 0) {
+        return i * 64 + __builtin_ctzll(word);
+      }
+    }
+    return run_classes;
+  }
+
+  // highest member, or run_classes if there is none
+  size_t top() const {
+    if (words_[1] != 0) {
+      return 64 + floor_log2(words_[1]);
+    }
+    return words_[0] != 0 ? floor_log2(words_[0]) : run_classes;
+  }
+};
+
+inline size_t round_up(size_t n) {
+  if (n > SIZE_MAX - granule) {
+    throw std::bad_alloc();
+  }
+  return n == 0 ? granule : (n + granule - 1) / granule * granule;
+}
+
+// data of every chunk starts at a cache line
+constexpr size_t data_alignment = 64;
+
+// bytes a fresh chunk needs to fit n bytes at the given alignment
+inline size_t padded(size_t n, size_t alignment) {
+  size_t padding = alignment > data_alignment ? alignment - data_alignment : 0;
+  if (n > SIZE_MAX - padding) {
+    throw std::bad_alloc();
+  }
+  return n + padding;
+}
+
+// forbid and allow touching memory under AddressSanitizer, no-ops without
+inline void poison(const void* ptr, size_t n) {
+#ifdef CHUNK_ALLOCATOR_ASAN
+  __asan_poison_memory_region(ptr, n);
+#else
+  (void)ptr;
+  (void)n;
+#endif
+}
+
+inline void unpoison(const void* ptr, size_t n) {
+#ifdef CHUNK_ALLOCATOR_ASAN
+  __asan_unpoison_memory_region(ptr, n);
+#else
+  (void)ptr;
+  (void)n;
+#endif
+}
+
+}  // namespace chunk_detail
+
+// Memory the chunks are created in
+enum class chunk_backing {
+  // the global aligned operator new
+  heap,
+  // anonymous mappings, the pages of empty chunks are given back to the OS
+  // but the chunks are kept for the following requests
+  mmap,
+  // as mmap, but with huge pages: reserved ones (MAP_HUGETLB) if there
+  // are any, otherwise transparent ones; chunks are at least 2 MiB and
+  // rounded up to a multiple of it, smaller chunk sizes are raised, and
+  // their headers live on the heap so that the data fills whole pages
+  huge_pages,
+};
+
+// Settings of the pool behind an allocator and all of its copies
+struct chunk_options {
+  // allow allocating and deallocating from several threads at once
+  bool concurrent = false;
+
+  // size of the first chunk; while k regular chunks are alive, the next
+  // one is 2^k times as large, up to max_chunk_size (at most 16 GiB);
+  // setting both to the same value keeps chunks fixed
+  size_t chunk_size = chunk_detail::default_chunk_size;
+  size_t max_chunk_size = chunk_detail::default_max_chunk_size;
+
+  chunk_backing backing = chunk_backing::heap;
+
+  // serve requests by bumping a pointer through the newest chunk;
+  // deallocate does nothing and memory comes back only with reset()
+  bool monotonic = false;
+};
+
+// Snapshot of a pool, see chunk_allocator::stats()
+struct chunk_stats {
+  struct chunk_info {
+    const void* address = nullptr;
+    size_t size = 0;
+    // engaged bytes, including the ones parked in free lists
+    size_t used = 0;
+    // runs of free granules and the longest of them in bytes
+    size_t fragments = 0;
+    size_t largest_free = 0;
+    // dedicated to a single request
+    bool large = false;
+
+    double fill() const { return size == 0 ? 0. : double(used) / size; }
+  };
+
+  std::vector<chunk_info> chunks;
+
+  // sizes of all chunks
+  size_t bytes_reserved = 0;
+  // bytes of blocks not yet deallocated; in concurrent pools this includes
+  // the blocks in thread caches
+  size_t bytes_in_use = 0;
+  // deallocated bytes parked in the size-class free lists
+  size_t bytes_cached = 0;
+  size_t bytes_free = 0;
+
+  size_t fragments = 0;
+  size_t largest_free = 0;
+
+  size_t allocations = 0;
+  size_t deallocations = 0;
+
+  // 0 when all free memory is a single block, approaches 1 as it gets
+  // scattered over many small ones
+  double fragmentation() const {
+    return bytes_free == 0 ? 0. : 1. - double(largest_free) / bytes_free;
+  }
+};
+
+namespace chunk_detail {
+
+class chunk;
+class chunk_shard;
+class chunk_pool;
+
+// Maps every page of chunk memory to its chunk, so the owner of a pointer
+// is found in constant time. It is a three-level radix tree over 48-bit
+// addresses shared by all pools: lookups are three loads and never lock,
+// nodes are created on demand and kept for the lifetime of the process.
+class page_map {
  public:
-  // default chunk_size is 4 KiB
-  static const size_t chunk_size = (1 << 12);
+  static constexpr size_t page_size = 1 << 12;
+
+  static page_map& instance() {
+    static page_map map;
+    return map;
+  }
+
+  chunk* find(const void* ptr) const {
+    size_t page = reinterpret_cast<uintptr_t>(ptr) / page_size;
+    if (page >> (3 * level_bits) != 0) {
+      return nullptr;
+    }
+    node* middle =
+        root_[page >> (2 * level_bits)].load(std::memory_order_acquire);
+    if (middle == nullptr) {
+      return nullptr;
+    }
+    leaf* last = middle->leaves[(page >> level_bits) % level_size].load(
+        std::memory_order_acquire);
+    if (last == nullptr) {
+      return nullptr;
+    }
+    return last->chunks[page % level_size].load(std::memory_order_acquire);
+  }
+
+  // map all pages intersecting [begin, begin + size) to target
+  void assign(const void* begin, size_t size, chunk* target) {
+    size_t first = reinterpret_cast<uintptr_t>(begin) / page_size;
+    size_t last = (reinterpret_cast<uintptr_t>(begin) + size - 1) / page_size;
+    if (last >> (3 * level_bits) != 0) {
+      throw std::out_of_range("Chunk address is out of the page map range");
+    }
+    for (size_t page = first; page <= last; ++page) {
+      leaf_of(page)->chunks[page % level_size].store(
+          target, std::memory_order_release);
+    }
+  }
 
  private:
-  class chunk {
-    // fragments contain pointers to allocated spaces
-    // and within chunk are organized as linked list
-    class fragment {
-     public:
-      // pointer to the begining of the fragment
-      uint8_t* ptr;
-      // length of the fragment space
-      size_t len;
-      // pointer to the next allocated fragment of the fragment
-      fragment* next;
-
-      fragment(uint8_t* ptr, size_t len, fragment* next)
-          : ptr(ptr), len(len), next(next) {}
-    };
-
-    // pointer to the begining of the allocated memory
-    uint8_t* data_ = nullptr;
-
-    // size of the allocated memory
-    // can't be modified after instantiation
-    size_t size_ = 0;
-
-    // head fragment
-    fragment* head_ = nullptr;
-
-    // previous chunk
-    chunk* prev_ = nullptr;
-
-   public:
-    chunk(size_t size, chunk* prev) : prev_(prev), size_(size) {
-      data_ = new uint8_t[sizeof(uint8_t) * size];
-    }
-    ~chunk() { delete[] data_; }
-
-    // get pointer to the previous chunk
-    chunk* prev() const { return prev_; }
-
-    // set pointer to the previous chunk
-    void set_prev(chunk* prev) { prev_ = prev; }
-
-    // split fragment then there is deallocating the middle of it 
-    void split(fragment* current, uint8_t* ptr, size_t n) {
-      size_t ost_len = current->len - n;
-      uint8_t* ost_ptr = current->ptr + (ost_len - (ptr - current->ptr));
-      fragment* ost = new fragment(ost_ptr, ost_len, current->next);
-      current->len = (ptr - current->ptr);
-      current->next = ost;
-    }
-
-    // engage new fragment
-    uint8_t* engage(size_t n) {
-      if (n > size_) {
-        throw std::out_of_range("Requested memeory is out of range");
+  static constexpr size_t level_bits = 12;
+  static constexpr size_t level_size = 1 << level_bits;
+
+  struct leaf {
+    std::atomic<chunk*> chunks[level_size];
+  };
+
+  struct node {
+    std::atomic<leaf*> leaves[level_size];
+  };
+
+  std::atomic<node*> root_[level_size] = {};
+
+  // guards creation of nodes
+  std::mutex mutex_;
+
+  page_map() = default;
+
+  leaf* leaf_of(size_t page) {
+    std::atomic<node*>& middle = root_[page >> (2 * level_bits)];
+    if (middle.load(std::memory_order_acquire) == nullptr) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (middle.load(std::memory_order_relaxed) == nullptr) {
+        middle.store(new node(), std::memory_order_release);
+      }
+    }
+    std::atomic<leaf*>& last =
+        middle.load(std::memory_order_acquire)
+            ->leaves[(page >> level_bits) % level_size];
+    if (last.load(std::memory_order_acquire) == nullptr) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (last.load(std::memory_order_relaxed) == nullptr) {
+        last.store(new leaf(), std::memory_order_release);
       }
+    }
+    return last.load(std::memory_order_acquire);
+  }
+};
+
+// Chunks keep all their bookkeeping inside the memory they are created
+// with: the header is followed by a bitmap with a bit per granule of data
+// (set for engaged granules) and the heads of the lists of free runs, one
+// per run class, which are followed by the data itself. Every free run
+// keeps its list links in its first granule and, unless it is a single
+// granule, its length in the low half of the second and the last ones, so
+// a request pops a run of the lowest class that fits it and a released
+// block merges with its free neighbours without walking the bitmap.
+// After a chunk is created, serving and releasing blocks never touches
+// the global heap.
+//
+// Large chunks are dedicated to a single request too big for the regular
+// ones, so they have no bitmap and are destroyed as soon as it is freed.
+class chunk {
+  // shard of the pool the chunk belongs to
+  chunk_shard* shard_ = nullptr;
+
+  // previous (older) and next (newer) chunks
+  chunk* prev_ = nullptr;
+  chunk* next_ = nullptr;
+
+  // size of the allocated memory
+  // can't be modified after instantiation
+  size_t size_ = 0;
+
+  // number of granules (and bits of the bitmap)
+  size_t granules_ = 0;
+
+  bool large_ = false;
 
-      if (head_ == nullptr) {
-        head_ = new fragment(data_, n, nullptr);
-        return head_->ptr;
+  chunk_backing backing_ = chunk_backing::heap;
+
+  // pointer to the begining of the data
+  uint8_t* data_ = nullptr;
+
+  static constexpr size_t word_bits = 64;
+
+  static size_t bitmap_words(size_t size, bool large) {
+    return large ? 0 : (size / granule + word_bits - 1) / word_bits;
+  }
+
+  // run classes up to the one of the whole data
+  static size_t list_count(size_t size, bool large) {
+    return large ? 0 : run_class(size / granule) + 1;
+  }
+
+  // bytes before the data, keeps the data aligned to a cache line
+  static size_t header_size(size_t size, bool large) {
+    size_t header = sizeof(chunk) +
+                    sizeof(uint64_t) * bitmap_words(size, large) +
+                    sizeof(uint32_t) * list_count(size, large);
+    return (header + data_alignment - 1) / data_alignment * data_alignment;
+  }
+
+  // offset of the first address not before data_ + offset that is
+  // a multiple of alignment, which is a power of two
+  size_t align(size_t offset, size_t alignment) const {
+    uintptr_t address = reinterpret_cast<uintptr_t>(data_) + offset;
+    return offset + ((0 - address) & (alignment - 1));
+  }
+
+  // chunks start at page boundaries, so no page is shared by two chunks
+  static constexpr std::align_val_t alignment{page_map::page_size};
+
+  // pages the mapped chunks are made of
+  static size_t mapping_page(chunk_backing backing) {
+    return backing == chunk_backing::huge_pages ? huge_page_size
+                                                : page_map::page_size;
+  }
+
+  static size_t mapping_size(size_t bytes, chunk_backing backing) {
+    size_t page = mapping_page(backing);
+    return (bytes + page - 1) / page * page;
+  }
+
+  static uint8_t* map(size_t bytes, chunk_backing backing) {
+#ifdef __linux__
+    size_t size = mapping_size(bytes, backing);
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (backing == chunk_backing::huge_pages) {
+      void* raw = mmap(nullptr, size, protection, flags | MAP_HUGETLB, -1, 0);
+      if (raw != MAP_FAILED) {
+        return static_cast<uint8_t*>(raw);
       }
 
-      fragment* current = head_;
-      for (fragment* following = current->next;
-           following != nullptr && following->ptr != nullptr;
-           following = following->next) {
-        if (n <= following->ptr - (current->ptr + current->len)) {
-          current->next =
-              new fragment(current->ptr + current->len, n, following);
-          return current->next->ptr;
-        }
-        current = following;
+      // no reserved huge pages, map a 2 MiB aligned range and let the
+      // kernel back it by transparent ones
+      size_t padded = size + huge_page_size;
+      raw = mmap(nullptr, padded, protection, flags, -1, 0);
+      if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      uint8_t* begin = static_cast<uint8_t*>(raw);
+      uint8_t* aligned = reinterpret_cast<uint8_t*>(
+          (reinterpret_cast<uintptr_t>(begin) + huge_page_size - 1) /
+          huge_page_size * huge_page_size);
+      if (aligned != begin) {
+        munmap(begin, aligned - begin);
       }
+      if (begin + padded != aligned + size) {
+        munmap(aligned + size, begin + padded - (aligned + size));
+      }
+      madvise(aligned, size, MADV_HUGEPAGE);
+      return aligned;
+    }
+
+    void* raw = mmap(nullptr, size, protection, flags, -1, 0);
+    if (raw == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    return static_cast<uint8_t*>(raw);
+#else
+    // no mappings on this platform, chunks stay on the heap
+    return static_cast<uint8_t*>(::operator new(bytes, alignment));
+#endif
+  }
+
+  static void unmap(uint8_t* raw, size_t bytes, chunk_backing backing) {
+#ifdef __linux__
+    munmap(raw, mapping_size(bytes, backing));
+#else
+    (void)bytes;
+    (void)backing;
+    ::operator delete(raw, alignment);
+#endif
+  }
+
+  // the header of a chunk backed by huge pages is allocated on its own,
+  // so the data starts and ends at huge page boundaries and reset() can
+  // give every page of it back
+  static bool separate_header(chunk_backing backing) {
+    return backing == chunk_backing::huge_pages;
+  }
+
+  // memory the pages of the chunk are mapped from, the header included
+  // unless it is separate
+  uint8_t* begin() {
+    return separate_header(backing_) ? data_
+                                     : reinterpret_cast<uint8_t*>(this);
+  }
+  size_t bytes() const {
+    return separate_header(backing_) ? size_
+                                     : header_size(size_, large_) + size_;
+  }
+
+  // classes with a non-empty list of free runs
+  class_set classes_;
 
-      if (n <= (data_ + size_) - (current->ptr + current->len)) {
-        current->next = new fragment(current->ptr + current->len, n, nullptr);
-        return current->next->ptr;
+  chunk(size_t size, bool large, chunk_shard* shard, uint8_t* data)
+      : shard_(shard),
+        size_(size),
+        granules_(size / granule),
+        large_(large),
+        data_(data) {
+    clear();
+  }
+
+  uint64_t* bitmap() { return reinterpret_cast<uint64_t*>(this + 1); }
+
+  // end of a list of free runs
+  static constexpr uint32_t no_run = UINT32_MAX;
+
+  // first runs of the lists, by class
+  uint32_t* lists() {
+    return reinterpret_cast<uint32_t*>(bitmap() +
+                                       bitmap_words(size_, large_));
+  }
+
+  bool engaged(size_t i) {
+    return (bitmap()[i / word_bits] >> (i % word_bits)) & 1;
+  }
+
+  // the next and the previous runs of the list of the run starting at i;
+  // freed blocks of guarded pools are poisoned, so the tags are unpoisoned
+  // before they are touched
+  uint32_t* links(size_t i) {
+    uint8_t* at = data_ + i * granule;
+    unpoison(at, 2 * sizeof(uint32_t));
+    return reinterpret_cast<uint32_t*>(at);
+  }
+
+  uint32_t& length_tag(size_t i) {
+    uint8_t* at = data_ + i * granule;
+    unpoison(at, sizeof(uint32_t));
+    return *reinterpret_cast<uint32_t*>(at);
+  }
+
+  // length of the free run starting at i
+  size_t head_length(size_t i) {
+    return i + 1 == granules_ || engaged(i + 1) ? 1 : length_tag(i + 1);
+  }
+
+  // length of the free run ending right before i
+  size_t tail_length(size_t i) {
+    return i == 1 || engaged(i - 2) ? 1 : length_tag(i - 1);
+  }
+
+  // put the free run [begin, begin + length) at the front of its list
+  void insert(size_t begin, size_t length) {
+    if (length > 1) {
+      length_tag(begin + 1) = uint32_t(length);
+      length_tag(begin + length - 1) = uint32_t(length);
+    }
+    size_t c = run_class(length);
+    uint32_t* head = links(begin);
+    head[0] = lists()[c];
+    head[1] = no_run;
+    if (lists()[c] != no_run) {
+      links(lists()[c])[1] = uint32_t(begin);
+    }
+    lists()[c] = uint32_t(begin);
+    classes_.insert(c);
+  }
+
+  // take the free run [begin, begin + length) out of its list
+  void erase(size_t begin, size_t length) {
+    size_t c = run_class(length);
+    uint32_t* head = links(begin);
+    uint32_t next = head[0];
+    uint32_t prev = head[1];
+    if (prev != no_run) {
+      links(prev)[0] = next;
+    } else {
+      lists()[c] = next;
+      if (next == no_run) {
+        classes_.erase(c);
       }
+    }
+    if (next != no_run) {
+      links(next)[1] = prev;
+    }
+  }
 
+  // engage count granules at a multiple of alignment in the free run
+  // starting at begin, returns nullptr if they do not fit there
+  uint8_t* carve(size_t begin, size_t count, size_t alignment) {
+    size_t end = begin + head_length(begin);
+    size_t start = align(begin * granule, alignment) / granule;
+    if (start + count > end) {
       return nullptr;
     }
+    erase(begin, end - begin);
+    mark(start, start + count, true);
+    if (begin < start) {
+      insert(begin, start - begin);
+    }
+    if (start + count < end) {
+      insert(start + count, end - start - count);
+    }
+    used += count * granule;
+    return data_ + start * granule;
+  }
+
+  // first granule not before i with the given state, or limit
+  size_t find(size_t i, size_t limit, bool state) {
+    while (i < limit) {
+      uint64_t word = bitmap()[i / word_bits];
+      if (!state) {
+        word = ~word;
+      }
+      word &= ~uint64_t(0) << (i % word_bits);
+      if (word != 0) {
+        size_t found = i / word_bits * word_bits + __builtin_ctzll(word);
+        return std::min(limit, found);
+      }
+      i = (i / word_bits + 1) * word_bits;
+    }
+    return limit;
+  }
+
+  // set or clear granules [begin, end), returns how many have changed
+  size_t mark(size_t begin, size_t end, bool state) {
+    size_t changed = 0;
+    while (begin < end) {
+      size_t bits = std::min(end - begin, word_bits - begin % word_bits);
+      uint64_t mask = (bits == word_bits ? ~uint64_t(0)
+                                         : (uint64_t(1) << bits) - 1)
+                      << (begin % word_bits);
+      uint64_t& word = bitmap()[begin / word_bits];
+      changed += __builtin_popcountll((state ? ~word : word) & mask);
+      word = state ? word | mask : word & ~mask;
+      begin += bits;
+    }
+    return changed;
+  }
+
+ public:
+  // engaged bytes, including the ones parked in the size-class free lists
+  size_t used = 0;
+
+  // engaged bytes parked in the size-class free lists
+  size_t cached = 0;
 
-    // release fragment space or part of it
-    void release(uint8_t* ptr, size_t n) {
-      if (head_ == nullptr || head_->ptr == nullptr) {
-        return;
+  // the bin of the shard the chunk is in and its neighbours there
+  static constexpr size_t no_bin = run_classes;
+  size_t bin = no_bin;
+  chunk* bin_prev = nullptr;
+  chunk* bin_next = nullptr;
+
+  static chunk* create(size_t size, bool large, chunk_shard* shard,
+                       chunk_backing backing) {
+    if (size > SIZE_MAX - header_size(size, large) - huge_page_size) {
+      throw std::bad_alloc();
+    }
+    if (separate_header(backing)) {
+      size = mapping_size(size, backing);
+    }
+    size_t header = header_size(size, large);
+    uint8_t* raw = nullptr;
+    uint8_t* data = nullptr;
+    if (backing == chunk_backing::heap) {
+      raw = static_cast<uint8_t*>(::operator new(header + size, alignment));
+      data = raw + header;
+    } else if (separate_header(backing)) {
+      data = map(size, backing);
+      try {
+        raw = static_cast<uint8_t*>(::operator new(header, alignment));
+      } catch (...) {
+        unmap(data, size, backing);
+        throw;
       }
+    } else {
+      raw = map(header + size, backing);
+      data = raw + header;
+    }
+    chunk* result = new (raw) chunk(size, large, shard, data);
+    result->backing_ = backing;
+    try {
+      page_map::instance().assign(result->begin(), result->bytes(), result);
+    } catch (...) {
+      destroy(result);
+      throw;
+    }
+    return result;
+  }
+
+  static void destroy(chunk* target) {
+    uint8_t* begin = target->begin();
+    size_t bytes = target->bytes();
+    uint8_t* data = target->data_;
+    size_t size = target->size_;
+    chunk_backing backing = target->backing_;
+    page_map::instance().assign(begin, bytes, nullptr);
+    // freed blocks of guarded pools stay poisoned until the chunk goes
+    unpoison(begin, bytes);
+    target->~chunk();
+    if (backing == chunk_backing::heap) {
+      ::operator delete(target, alignment);
+    } else if (separate_header(backing)) {
+      unmap(data, size, backing);
+      ::operator delete(target, alignment);
+    } else {
+      unmap(begin, bytes, backing);
+    }
+  }
+
+  // get shard the chunk belongs to
+  chunk_shard* shard() const { return shard_; }
+
+  // check if chunk is dedicated to a single request
+  bool large() const { return large_; }
+
+  // check if chunk is kept after it gets empty
+  bool retained() const {
+    return backing_ != chunk_backing::heap && !large_;
+  }
+
+  // forget all blocks of the chunk
+  void clear() {
+    used = 0;
+    cached = 0;
+    if (large_) {
+      return;
+    }
+    std::fill(bitmap(), bitmap() + bitmap_words(size_, large_), 0);
+    std::fill(lists(), lists() + list_count(size_, large_), no_run);
+    classes_.clear();
+    insert(0, granules_);
+  }
+
+  // forget all blocks of an empty chunk and give its whole data pages
+  // back to the OS, they read as zeros when touched again
+  void reset() {
+#ifdef __linux__
+    size_t page = mapping_page(backing_);
+    uintptr_t begin =
+        (reinterpret_cast<uintptr_t>(data_) + page - 1) / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(data_ + size_) / page * page;
+    if (begin < end) {
+      madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+#endif
+    // the tags of the free run go to the data, so after the pages
+    clear();
+  }
+
+  // get and set pointers to the previous and the next chunks
+  chunk* prev() const { return prev_; }
+  chunk* next() const { return next_; }
+  void set_prev(chunk* prev) { prev_ = prev; }
+  void set_next(chunk* next) { next_ = next; }
+
+  // engage n bytes at a multiple of alignment in a free run of the lowest
+  // class that fits them, returns nullptr if there is none
+  uint8_t* engage(size_t n, size_t alignment) {
+    if (n > size_) {
+      return nullptr;
+    }
+    if (large_) {
+      size_t begin = align(0, alignment);
+      if (used != 0 || begin > size_ - n) {
+        return nullptr;
+      }
+      used = n;
+      return data_ + begin;
+    }
 
-      if (head_->ptr == ptr) {
-        if (n == head_->len) {
-          delete head_;
-          head_ = nullptr;
-        } else if (n < head_->len) {
-          head_->ptr += n;
+    // every run of the classes from this one fits n bytes at any alignment
+    size_t count = n / granule;
+    size_t certain = classes_.lower_bound(
+        fitting_class((n + alignment - granule) / granule));
+    if (certain != run_classes) {
+      return carve(lists()[certain], count, alignment);
+    }
+
+    // runs of the lower classes may fit, depending on their length and
+    // where they start
+    for (size_t c = classes_.lower_bound(run_class(count)); c != run_classes;
+         c = classes_.lower_bound(c + 1)) {
+      for (uint32_t begin = lists()[c]; begin != no_run;
+           begin = links(begin)[0]) {
+        uint8_t* result = carve(begin, count, alignment);
+        if (result != nullptr) {
+          return result;
         }
-        return;
       }
-      if (head_->ptr < ptr && ptr + n < (head_->ptr + head_->len)) {
-        split(head_, ptr, n);
-        return;
+    }
+    return nullptr;
+  }
+
+  // engage n bytes right after the engaged ones, for chunks that never
+  // release anything, returns nullptr if they do not fit
+  uint8_t* bump(size_t n, size_t alignment) {
+    size_t begin = align(used, alignment);
+    if (begin > size_ || n > size_ - begin) {
+      return nullptr;
+    }
+    used = begin + n;
+    return data_ + begin;
+  }
+
+  // release n bytes from ptr, which may be any part of an engaged space,
+  // returns the number of bytes actually released
+  size_t release(uint8_t* ptr, size_t n) {
+    if (large_) {
+      size_t released = used;
+      used = 0;
+      return released;
+    }
+    size_t begin = (ptr - data_) / granule;
+    size_t end = std::min(granules_, begin + n / granule);
+    size_t released = mark(begin, end, false) * granule;
+    used -= released;
+
+    // the released granules merge with the free neighbours
+    if (begin > 0 && !engaged(begin - 1)) {
+      size_t length = tail_length(begin);
+      begin -= length;
+      erase(begin, length);
+    }
+    if (end < granules_ && !engaged(end)) {
+      size_t length = head_length(end);
+      erase(end, length);
+      end += length;
+    }
+    insert(begin, end - begin);
+    return released;
+  }
+
+  // class of the longest free run, no_bin if there is none
+  size_t top_class() const { return classes_.top(); }
+
+  // check if chunk contains allocated address
+  bool contains(uint8_t* ptr) const {
+    return data_ <= ptr && ptr < (data_ + size_);
+  }
+
+  // describe the chunk; bumped chunks are engaged from the beginning
+  // up to used and have no bitmap to look at
+  chunk_stats::chunk_info info(bool bumped) {
+    chunk_stats::chunk_info result;
+    result.address = data_;
+    result.size = size_;
+    result.used = used;
+    result.large = large_;
+    if (large_ || bumped) {
+      result.fragments = used < size_ ? 1 : 0;
+      result.largest_free = size_ - used;
+      return result;
+    }
+    for (size_t begin = find(0, granules_, false); begin < granules_;) {
+      size_t end = find(begin, granules_, true);
+      result.fragments += 1;
+      result.largest_free =
+          std::max(result.largest_free, (end - begin) * granule);
+      begin = find(end, granules_, false);
+    }
+    return result;
+  }
+
+  // one character per width-th part of the data: '#' if it is engaged,
+  // '.' if it is free and '+' if it is both
+  std::string map(bool bumped, size_t width) {
+    std::string result(width, '.');
+    size_t engaged = (used + granule - 1) / granule;
+    for (size_t i = 0; i < width; ++i) {
+      size_t begin = granules_ * i / width;
+      size_t end = std::max(begin + 1, granules_ * (i + 1) / width);
+      bool full, empty;
+      if (large_ || bumped) {
+        full = end <= engaged;
+        empty = begin >= engaged;
+      } else {
+        full = find(begin, end, false) == end;
+        empty = find(begin, end, true) == end;
+      }
+      result[i] = full ? '#' : (empty ? '.' : '+');
+    }
+    return result;
+  }
+};
+
+// Freed blocks of one size. They stay engaged in their chunks, so a
+// following request of the same size pops one without searching chunks.
+struct size_class {
+  struct block {
+    uint8_t* ptr;
+    chunk* owner;
+  };
+
+  block blocks[class_depth];
+  size_t count = 0;
+};
+
+// Chunks and size-class free lists. A pool has a single shard unless it is
+// concurrent, then every shard is guarded by its own mutex.
+class chunk_shard {
+  chunk_pool* pool_ = nullptr;
+
+  // size of the first regular chunk and the cap of their growth
+  size_t chunk_size_ = 0;
+  size_t max_size_ = 0;
+
+  // regular chunks alive, the next one doubles in size with every one of
+  // them, so a chunk emptied and created again does not keep growing
+  size_t regular_count_ = 0;
+
+  chunk_backing backing_ = chunk_backing::heap;
+  bool monotonic_ = false;
+
+  // last created chunk
+  chunk* tail_ = nullptr;
+
+  // newest regular chunk, monotonic pools bump through it
+  chunk* current_ = nullptr;
+
+  // regular chunk kept when it got empty, unless blocks have been engaged
+  // in it since
+  chunk* spare_ = nullptr;
+
+  // regular chunks by the class of their longest free run, the mask
+  // has the classes of the bins that are not empty
+  static constexpr size_t bin_count = run_classes;
+  chunk* bins_[bin_count] = {};
+  class_set bin_mask_;
+
+  void unbin(chunk* target) {
+    if (target->bin == chunk::no_bin) {
+      return;
+    }
+    if (target->bin_prev != nullptr) {
+      target->bin_prev->bin_next = target->bin_next;
+    } else {
+      bins_[target->bin] = target->bin_next;
+      if (target->bin_next == nullptr) {
+        bin_mask_.erase(target->bin);
       }
+    }
+    if (target->bin_next != nullptr) {
+      target->bin_next->bin_prev = target->bin_prev;
+    }
+    target->bin = chunk::no_bin;
+    target->bin_prev = target->bin_next = nullptr;
+  }
 
-      fragment* current = head_;
-      for (fragment* following = current->next;
-           following != nullptr && following->ptr != nullptr;
-           following = following->next) {
-
-        if (following->ptr == ptr) {
-          if (n == following->len) {
-            current->next = following->next;
-            delete following;
-          } else if (n < following->len) {
-            following->ptr += n;
-          }
-          return;
+  // move the chunk to the bin of its longest free run
+  void rebin(chunk* target) {
+    size_t bin = target->top_class();
+    if (target->large() || bin == target->bin) {
+      return;
+    }
+    unbin(target);
+    if (bin == chunk::no_bin) {
+      return;
+    }
+    target->bin = bin;
+    target->bin_next = bins_[bin];
+    if (bins_[bin] != nullptr) {
+      bins_[bin]->bin_prev = target;
+    }
+    bins_[bin] = target;
+    bin_mask_.insert(bin);
+  }
+
+  // engage n bytes in the chunk with the shortest longest free run that
+  // certainly fits them, returns nullptr if there is none
+  uint8_t* fit(size_t n, size_t alignment) {
+    // every chunk from these bins has a run that fits n bytes at any
+    // alignment, so the first one does
+    size_t count = (n + alignment - granule) / granule;
+    size_t certain = bin_mask_.lower_bound(fitting_class(count));
+    if (certain != chunk::no_bin) {
+      chunk* best = bins_[certain];
+      uint8_t* result = best->engage(n, alignment);
+      rebin(best);
+      return result;
+    }
+
+    // the lower bins have the chunks whose runs may fit or may be too short
+    for (size_t bin = bin_mask_.lower_bound(run_class(n / granule));
+         bin != chunk::no_bin; bin = bin_mask_.lower_bound(bin + 1)) {
+      for (chunk* current = bins_[bin]; current != nullptr;
+           current = current->bin_next) {
+        uint8_t* result = current->engage(n, alignment);
+        if (result != nullptr) {
+          rebin(current);
+          return result;
         }
-        if (following->ptr < ptr && ptr + n < (following->ptr + following->len)) {
-          split(following, ptr, n);
-          return;
+      }
+    }
+    return nullptr;
+  }
+
+  // give all parked blocks back to their chunks, returns if there were any
+  bool flush_classes() {
+    bool flushed = false;
+    for (size_t i = 0; i < small_classes; ++i) {
+      size_class& cls = classes_[i];
+      size_t n = (i + 1) * granule;
+      while (cls.count != 0) {
+        size_class::block top = cls.blocks[--cls.count];
+        top.owner->cached -= n;
+        top.owner->release(top.ptr, n);
+        settle(top.owner);
+        flushed = true;
+      }
+    }
+    return flushed;
+  }
+
+  // update the index after blocks of the chunk have been released;
+  // a chunk with parked blocks stays until they are flushed, and the
+  // first regular chunk to get empty is kept as the spare, so a block
+  // allocated and freed over and over does not create and destroy a chunk
+  // every time; the following empty ones go, or give their pages back
+  void settle(chunk* owner) {
+    if (owner->used != 0) {
+      rebin(owner);
+      return;
+    }
+    if (owner->large()) {
+      remove(owner);
+    } else if (spare_ == nullptr || spare_ == owner || spare_->used != 0) {
+      spare_ = owner;
+      rebin(owner);
+    } else if (owner->retained()) {
+      owner->reset();
+      rebin(owner);
+    } else {
+      remove(owner);
+    }
+  }
+
+  size_class classes_[small_classes];
+
+  chunk* append(size_t size, bool large) {
+    chunk* created = chunk::create(size, large, this, backing_);
+    created->set_prev(tail_);
+    if (tail_ != nullptr) {
+      tail_->set_next(created);
+    }
+    tail_ = created;
+    return created;
+  }
+
+  void remove(chunk* target) {
+    unbin(target);
+    if (!target->large()) {
+      --regular_count_;
+    }
+    if (target == current_) {
+      current_ = nullptr;
+    }
+    if (target == spare_) {
+      spare_ = nullptr;
+    }
+    if (target->next() != nullptr) {
+      target->next()->set_prev(target->prev());
+    } else {
+      tail_ = target->prev();
+    }
+    if (target->prev() != nullptr) {
+      target->prev()->set_next(target->next());
+    }
+    chunk::destroy(target);
+  }
+
+  // create a chunk for n bytes: a dedicated one if n is over the cap,
+  // otherwise the next regular one
+  chunk* grow(size_t n) {
+    if (n > max_size_) {
+      return append(n, true);
+    }
+    size_t size = chunk_size_;
+    for (size_t i = 0; i < regular_count_ && size < max_size_; ++i) {
+      size = std::min(size * 2, max_size_);
+    }
+    while (size < n) {
+      size = std::min(size * 2, max_size_);
+    }
+    current_ = append(size, false);
+    ++regular_count_;
+    rebin(current_);
+    return current_;
+  }
+
+  // engage n bytes in the best fitting chunk, before creating a new one
+  // the blocks parked in the size-class free lists are given back
+  uint8_t* engage(size_t n, size_t alignment) {
+    size_t needed = padded(n, alignment);
+    if (needed > max_size_) {
+      return grow(needed)->engage(n, alignment);
+    }
+
+    uint8_t* result = fit(n, alignment);
+    if (result == nullptr && flush_classes()) {
+      result = fit(n, alignment);
+    }
+    if (result == nullptr) {
+      chunk* created = grow(needed);
+      result = created->engage(n, alignment);
+      rebin(created);
+    }
+    return result;
+  }
+
+ public:
+  std::mutex mutex;
+
+  chunk_shard() = default;
+  chunk_shard(const chunk_shard&) = delete;
+  chunk_shard& operator=(const chunk_shard&) = delete;
+
+  ~chunk_shard() {
+    while (tail_ != nullptr) {
+      chunk* prev = tail_->prev();
+      chunk::destroy(tail_);
+      tail_ = prev;
+    }
+  }
+
+  void init(chunk_pool* pool, const chunk_options& options) {
+    pool_ = pool;
+    chunk_size_ = round_up(options.chunk_size);
+    max_size_ = std::max(chunk_size_, round_up(options.max_chunk_size));
+    chunk_size_ = std::min(chunk_size_, max_regular_size);
+    max_size_ = std::min(max_size_, max_regular_size);
+    backing_ = options.backing;
+    if (backing_ == chunk_backing::huge_pages) {
+      // smaller chunks would be rounded up to a whole huge page anyway
+      chunk_size_ = std::max(chunk_size_, huge_page_size);
+      max_size_ = std::max(max_size_, huge_page_size);
+    }
+    monotonic_ = options.monotonic;
+  }
+
+  chunk_pool* pool() const { return pool_; }
+
+  // n is rounded up to whole granules, alignment is a power of two
+  // not less than a granule
+  uint8_t* allocate(size_t n, size_t alignment) {
+    if (cacheable(n, alignment)) {
+      size_class& cls = classes_[n / granule - 1];
+      if (cls.count != 0) {
+        size_class::block& top = cls.blocks[--cls.count];
+        top.owner->cached -= n;
+        return top.ptr;
+      }
+    }
+    return engage(n, alignment);
+  }
+
+  // as allocate, but blocks are never given back
+  uint8_t* bump(size_t n, size_t alignment) {
+    if (n <= max_size_ && current_ != nullptr) {
+      uint8_t* result = current_->bump(n, alignment);
+      if (result != nullptr) {
+        return result;
+      }
+    }
+    return grow(padded(n, alignment))->bump(n, alignment);
+  }
+
+  // hand out up to count small blocks of n bytes at once,
+  // returns how many were written to blocks
+  size_t allocate(size_t n, uint8_t** blocks, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      try {
+        blocks[i] = allocate(n, granule);
+      } catch (...) {
+        if (i == 0) {
+          throw;
         }
-        current = following;
+        return i;
+      }
+    }
+    return count;
+  }
+
+  void deallocate(chunk* owner, uint8_t* ptr, size_t n, size_t alignment) {
+    if (cacheable(n, alignment)) {
+      size_class& cls = classes_[n / granule - 1];
+      if (cls.count < class_depth) {
+        cls.blocks[cls.count++] = {ptr, owner};
+        owner->cached += n;
+      } else {
+        owner->release(ptr, n);
       }
+    } else {
+      owner->release(ptr, n);
+    }
+    settle(owner);
+  }
+
+  // forget all blocks at once, the newest regular chunk is kept for reuse
+  void reset() {
+    for (size_class& cls : classes_) {
+      cls.count = 0;
+    }
+    std::fill(bins_, bins_ + bin_count, nullptr);
+    bin_mask_.clear();
+    chunk* kept = current_;
+    while (tail_ != nullptr) {
+      chunk* prev = tail_->prev();
+      if (tail_ != kept) {
+        chunk::destroy(tail_);
+      }
+      tail_ = prev;
+    }
+    tail_ = kept;
+    spare_ = kept;
+    regular_count_ = kept != nullptr ? 1 : 0;
+    if (kept != nullptr) {
+      kept->set_prev(nullptr);
+      kept->set_next(nullptr);
+      kept->clear();
+      kept->bin = chunk::no_bin;
+      kept->bin_prev = kept->bin_next = nullptr;
+      rebin(kept);
+    }
+  }
+
+  size_t chunk_count() const {
+    size_t count = 0;
+    for (chunk* cur = tail_; cur != nullptr; cur = cur->prev()) {
+      count += 1;
+    }
+    return count;
+  }
+
+  // add the chunks of the shard to stats, oldest first
+  void collect(chunk_stats& stats) {
+    size_t first = stats.chunks.size();
+    for (chunk* current = tail_; current != nullptr;
+         current = current->prev()) {
+      stats.chunks.push_back(current->info(monotonic_));
+      stats.bytes_cached += current->cached;
     }
+    std::reverse(stats.chunks.begin() + first, stats.chunks.end());
+  }
 
-    // check if fragment contains allocated address
-    bool contains(uint8_t* ptr) {
-      return data_ <= ptr && ptr < (data_ + size_);
+  // print a line per chunk with the map of its data, oldest first
+  void dump(std::ostream& out, size_t width) {
+    chunk* current = tail_;
+    while (current != nullptr && current->prev() != nullptr) {
+      current = current->prev();
+    }
+    for (; current != nullptr; current = current->next()) {
+      chunk_stats::chunk_info info = current->info(monotonic_);
+      out << info.address << ' ' << info.size << " B "
+          << static_cast<int>(info.fill() * 100) << "% ";
+      if (info.large) {
+        out << "large";
+      } else {
+        out << '[' << current->map(monotonic_, width) << ']';
+      }
+      out << '\n';
     }
-    
-    // check if fragment is empty
-    bool empty() { return head_ == nullptr; }
+  }
+};
+
+// Small blocks a thread has freed, kept for its own next requests
+// without taking any lock
+struct thread_cache {
+  struct stack {
+    uint8_t* blocks[class_depth];
+    size_t count = 0;
   };
 
-  struct chunk_shares {
-    chunk* tail;
-    size_t counter;
+  std::thread::id owner;
+  chunk_shard* home = nullptr;
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> deallocations{0};
+  thread_cache* next = nullptr;
+  stack classes[small_classes];
+};
+
+// Ids of the pools alive, so exiting threads know which caches
+// they can still return to their pools
+struct pool_registry {
+  std::mutex mutex;
+  std::unordered_set<uint64_t> alive;
+  uint64_t last_id = 0;
+
+  static pool_registry& instance() {
+    static pool_registry registry;
+    return registry;
+  }
+};
+
+// Caches of a thread for the concurrent pools it has recently used
+struct thread_caches {
+  struct slot {
+    uint64_t id = 0;
+    chunk_pool* pool = nullptr;
+    thread_cache* cache = nullptr;
   };
 
+  static constexpr size_t slot_count = 8;
+  slot slots[slot_count];
+
+  ~thread_caches();
+
+  static thread_caches& instance() {
+    thread_local thread_caches caches;
+    return caches;
+  }
+};
+
+#ifdef CHUNK_ALLOCATOR_DEBUG
+
+// Guards of the hardened mode, enabled with CHUNK_ALLOCATOR_DEBUG. Every
+// block is preceded by max(alignment, 16) bytes of canary ending with the
+// header below and followed by 16 more bytes of canary. The block is
+// filled with fresh_byte when allocated and with freed_byte when freed;
+// under AddressSanitizer the canaries and freed blocks are poisoned too,
+// so stray accesses are reported right away.
+class block_guard {
+ private:
+  // the state goes last: a chunk keeps the tags of a free run in the
+  // first 12 bytes of it, so a released block still reads as freed
+  struct header {
+    size_t size;
+    uint32_t alignment_log;
+    uint32_t state;
+  };
+
+  static constexpr size_t back_size = 16;
+  static constexpr uint32_t live = 0xa110c8ed;
+  static constexpr uint32_t freed = 0xf7eed0ff;
+  static constexpr uint8_t canary = 0xfd;
+
+  static size_t front(size_t alignment) {
+    return std::max(alignment, sizeof(header));
+  }
+
+  static header* header_of(uint8_t* ptr) {
+    return reinterpret_cast<header*>(ptr) - 1;
+  }
+
+  static bool intact(const uint8_t* begin, const uint8_t* end) {
+    return std::all_of(begin, end, [](uint8_t b) { return b == canary; });
+  }
+
+ public:
+  static constexpr uint8_t fresh_byte = 0xcd;
+  static constexpr uint8_t freed_byte = 0xdd;
+
+  // bytes a guarded block of n bytes takes
+  static size_t size(size_t n, size_t alignment) {
+    size_t guards = front(alignment) + back_size;
+    if (n > SIZE_MAX - guards) {
+      throw std::bad_alloc();
+    }
+    return n + guards;
+  }
+
+  // put the guards around the block in raw, returns the block
+  static uint8_t* arm(uint8_t* raw, size_t n, size_t alignment) {
+    size_t total = size(n, alignment);
+    uint8_t* ptr = raw + front(alignment);
+    unpoison(raw, total);
+    std::fill(raw, raw + total, canary);
+    *header_of(ptr) = {n, uint32_t(floor_log2(alignment)), live};
+    std::fill(ptr, ptr + n, fresh_byte);
+    poison(raw, ptr - raw);
+    poison(ptr + n, back_size);
+    return ptr;
+  }
+
+  // check the guards of the block and poison it, returns the raw bytes
+  // to deallocate; throws if the block is freed twice, freed with other
+  // size or alignment than it was allocated with, or overrun
+  static uint8_t* disarm(uint8_t* ptr, size_t n, size_t alignment) {
+    header* head = header_of(ptr);
+    unpoison(head, sizeof(header));
+    if (head->state == freed) {
+      throw std::invalid_argument("Block is deallocated twice");
+    }
+    if (head->state != live) {
+      throw std::runtime_error("Guard before the block is overwritten");
+    }
+    if (head->size != n) {
+      throw std::invalid_argument("Block is deallocated with a wrong size");
+    }
+    if (head->alignment_log != floor_log2(alignment)) {
+      throw std::invalid_argument(
+          "Block is deallocated with a wrong alignment");
+    }
+    size_t total = size(n, alignment);
+    uint8_t* raw = ptr - front(alignment);
+    unpoison(raw, total);
+    if (!intact(raw, reinterpret_cast<uint8_t*>(head))) {
+      throw std::runtime_error("Guard before the block is overwritten");
+    }
+    if (!intact(ptr + n, raw + total)) {
+      throw std::runtime_error("Guard after the block is overwritten");
+    }
+    head->state = freed;
+    std::fill(ptr, ptr + n, freed_byte);
+    poison(raw, total);
+    return raw;
+  }
+};
+
+#endif
+
+// Shards, thread caches and the reference counter shared by all copies of
+// an allocator, including the ones rebound to other types
+class chunk_pool {
+  const bool concurrent_;
+  const bool monotonic_;
+  const uint64_t id_;
+
+  size_t shard_count_;
+  std::unique_ptr<chunk_shard[]> shards_;
+
+  // caches of the threads that have used the pool, concurrent pools only
+  std::mutex caches_mutex_;
+  thread_cache* caches_ = nullptr;
+
+  // allocate and deallocate calls of single-threaded pools,
+  // concurrent ones count them in thread caches
+  size_t allocations_ = 0;
+  size_t deallocations_ = 0;
+
+  using lock_guard = std::unique_lock<std::mutex>;
+
+  // only the owner thread writes the counter, so no atomic increment
+  static void count(std::atomic<size_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  lock_guard lock(chunk_shard& shard) {
+    return concurrent_ ? lock_guard(shard.mutex) : lock_guard();
+  }
+
+  chunk* owner(uint8_t* ptr) {
+    chunk* result = page_map::instance().find(ptr);
+    if (result == nullptr || result->shard()->pool() != this ||
+        !result->contains(ptr)) {
+      return nullptr;
+    }
+    return result;
+  }
+
+  thread_cache& local_cache() {
+    thread_caches::slot& slot =
+        thread_caches::instance().slots[id_ % thread_caches::slot_count];
+    if (slot.id != id_) {
+      flush(slot);
+      slot = {id_, this, acquire_cache()};
+    }
+    return *slot.cache;
+  }
+
+  // find the cache a thread has left before or create a new one
+  thread_cache* acquire_cache() {
+    std::lock_guard<std::mutex> guard(caches_mutex_);
+    auto id = std::this_thread::get_id();
+    for (thread_cache* cache = caches_; cache != nullptr;
+         cache = cache->next) {
+      if (cache->owner == id) {
+        return cache;
+      }
+    }
+    thread_cache* cache = new thread_cache();
+    cache->owner = id;
+    cache->home = &shards_[std::hash<std::thread::id>()(id) % shard_count_];
+    cache->next = caches_;
+    caches_ = cache;
+    return cache;
+  }
+
+  // return count blocks of n bytes to the shards of their chunks
+  void release(uint8_t** blocks, size_t count, size_t n) {
+    for (size_t i = 0; i < count; ++i) {
+      chunk* current = owner(blocks[i]);
+      chunk_shard& shard = *current->shard();
+      auto guard = lock(shard);
+      shard.deallocate(current, blocks[i], n, granule);
+    }
+  }
+
+ public:
+  // number of allocators sharing the pool
+  std::atomic<size_t> counter{1};
+
+  explicit chunk_pool(const chunk_options& options)
+      : concurrent_(options.concurrent),
+        monotonic_(options.monotonic),
+        id_(register_pool()),
+        shard_count_(options.concurrent ? shards_for_threads() : 1),
+        shards_(new chunk_shard[shard_count_]) {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      shards_[i].init(this, options);
+    }
+  }
+
+  chunk_pool(const chunk_pool&) = delete;
+  chunk_pool& operator=(const chunk_pool&) = delete;
+
+  ~chunk_pool() {
+    {
+      pool_registry& registry = pool_registry::instance();
+      std::lock_guard<std::mutex> guard(registry.mutex);
+      registry.alive.erase(id_);
+    }
+    while (caches_ != nullptr) {
+      thread_cache* next = caches_->next;
+      delete caches_;
+      caches_ = next;
+    }
+  }
+
+  static size_t shards_for_threads() {
+    return std::min<size_t>(max_shards,
+                            std::max(1u, std::thread::hardware_concurrency()));
+  }
+
+  static uint64_t register_pool() {
+    pool_registry& registry = pool_registry::instance();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.alive.insert(++registry.last_id);
+    return registry.last_id;
+  }
+
+  bool concurrent() const { return concurrent_; }
+
+  // alignment is a power of two
+  uint8_t* allocate(size_t n, size_t alignment) {
+#ifdef CHUNK_ALLOCATOR_DEBUG
+    alignment = std::max(alignment, granule);
+    return block_guard::arm(
+        allocate_block(block_guard::size(n, alignment), alignment), n,
+        alignment);
+#else
+    return allocate_block(n, alignment);
+#endif
+  }
+
+  // alignment is the one the block was allocated with
+  void deallocate(uint8_t* ptr, size_t n, size_t alignment) {
+#ifdef CHUNK_ALLOCATOR_DEBUG
+    alignment = std::max(alignment, granule);
+    if (owner(ptr) == nullptr) {
+      throw std::invalid_argument("Block does not belong to the allocator");
+    }
+    deallocate_block(block_guard::disarm(ptr, n, alignment),
+                     block_guard::size(n, alignment), alignment);
+#else
+    deallocate_block(ptr, n, alignment);
+#endif
+  }
+
+ private:
+  uint8_t* allocate_block(size_t n, size_t alignment) {
+    n = round_up(n);
+    alignment = std::max(alignment, granule);
+    if (!concurrent_) {
+      ++allocations_;
+      return monotonic_ ? shards_[0].bump(n, alignment)
+                        : shards_[0].allocate(n, alignment);
+    }
+
+    thread_cache& cache = local_cache();
+    count(cache.allocations);
+    if (monotonic_ || !cacheable(n, alignment)) {
+      auto guard = lock(*cache.home);
+      return monotonic_ ? cache.home->bump(n, alignment)
+                        : cache.home->allocate(n, alignment);
+    }
+
+    thread_cache::stack& stack = cache.classes[n / granule - 1];
+    if (stack.count == 0) {
+      auto guard = lock(*cache.home);
+      stack.count = cache.home->allocate(n, stack.blocks, class_depth / 2);
+    }
+    return stack.blocks[--stack.count];
+  }
+
+  void deallocate_block(uint8_t* ptr, size_t n, size_t alignment) {
+    n = round_up(n);
+    alignment = std::max(alignment, granule);
+    chunk* current = owner(ptr);
+    if (current == nullptr) {
+      return;
+    }
+    if (!concurrent_) {
+      ++deallocations_;
+      if (!monotonic_) {
+        current->shard()->deallocate(current, ptr, n, alignment);
+      }
+      return;
+    }
+
+    thread_cache& cache = local_cache();
+    count(cache.deallocations);
+    if (monotonic_) {
+      return;
+    }
+    if (!cacheable(n, alignment)) {
+      auto guard = lock(*current->shard());
+      current->shard()->deallocate(current, ptr, n, alignment);
+      return;
+    }
+
+    thread_cache::stack& stack = cache.classes[n / granule - 1];
+    if (stack.count == class_depth) {
+      stack.count -= class_depth / 2;
+      release(stack.blocks + stack.count, class_depth / 2, n);
+    }
+    stack.blocks[stack.count++] = ptr;
+  }
+
+ public:
+  // return everything cached by the calling thread to the shards
+  void flush(thread_cache& cache) {
+    for (size_t i = 0; i < small_classes; ++i) {
+      thread_cache::stack& stack = cache.classes[i];
+      release(stack.blocks, stack.count, (i + 1) * granule);
+      stack.count = 0;
+    }
+  }
+
+  // return a slot of the calling thread to its pool, if it is still alive
+  static void flush(thread_caches::slot& slot) {
+    if (slot.cache == nullptr) {
+      return;
+    }
+    pool_registry& registry = pool_registry::instance();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    if (registry.alive.count(slot.id) != 0) {
+      slot.pool->flush(*slot.cache);
+    }
+  }
+
+  chunk_stats stats() {
+    chunk_stats result;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      auto guard = lock(shards_[i]);
+      shards_[i].collect(result);
+    }
+    size_t used = 0;
+    for (const chunk_stats::chunk_info& info : result.chunks) {
+      result.bytes_reserved += info.size;
+      used += info.used;
+      result.fragments += info.fragments;
+      result.largest_free = std::max(result.largest_free, info.largest_free);
+    }
+    result.bytes_in_use = used - result.bytes_cached;
+    result.bytes_free = result.bytes_reserved - used;
+
+    result.allocations = allocations_;
+    result.deallocations = deallocations_;
+    std::lock_guard<std::mutex> guard(caches_mutex_);
+    for (thread_cache* cache = caches_; cache != nullptr;
+         cache = cache->next) {
+      result.allocations += cache->allocations.load(std::memory_order_relaxed);
+      result.deallocations +=
+          cache->deallocations.load(std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+  void dump(std::ostream& out, size_t width) {
+    chunk_stats summary = stats();
+    out << "chunks: " << summary.chunks.size()
+        << ", reserved: " << summary.bytes_reserved
+        << " B, in use: " << summary.bytes_in_use
+        << " B, cached: " << summary.bytes_cached
+        << " B, free: " << summary.bytes_free
+        << " B, largest free: " << summary.largest_free
+        << " B, fragments: " << summary.fragments
+        << ", fragmentation: " << summary.fragmentation()
+        << ", allocations: " << summary.allocations
+        << ", deallocations: " << summary.deallocations << '\n';
+    for (size_t i = 0; i < shard_count_; ++i) {
+      auto guard = lock(shards_[i]);
+      if (shard_count_ > 1) {
+        out << "shard " << i << ":\n";
+      }
+      shards_[i].dump(out, width);
+    }
+  }
+
+  // forget all blocks at once, must not run concurrently with other calls
+  void reset() {
+    {
+      std::lock_guard<std::mutex> guard(caches_mutex_);
+      for (thread_cache* cache = caches_; cache != nullptr;
+           cache = cache->next) {
+        for (thread_cache::stack& stack : cache->classes) {
+          stack.count = 0;
+        }
+      }
+    }
+    for (size_t i = 0; i < shard_count_; ++i) {
+      auto guard = lock(shards_[i]);
+      shards_[i].reset();
+    }
+  }
+
+  size_t chunk_count() {
+    size_t count = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      auto guard = lock(shards_[i]);
+      count += shards_[i].chunk_count();
+    }
+    return count;
+  }
+};
+
+inline thread_caches::~thread_caches() {
+  for (slot& current : slots) {
+    chunk_pool::flush(current);
+  }
+}
+
+}  // namespace chunk_detail
+
+template <typename T>
+struct chunk_allocator {
+ public:
+  // default size of the first chunk is 4 KiB
+  static const size_t chunk_size = chunk_detail::default_chunk_size;
+
+ private:
+  template <typename U>
+  friend struct chunk_allocator;
+
+  using chunk_shares = chunk_detail::chunk_pool;
+
   chunk_shares* shares_;
 
+  void release_shares() {
+    if (shares_->counter.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete shares_;
+    }
+  }
+
  public:
   using value_type = T;
   using pointer = T*;
@@ -155,87 +1726,59 @@ struct chunk_allocator {
   using reference = T&;
   using const_reference = const T&;
   using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
 
   template <typename U>
   struct rebind { typedef chunk_allocator<U> other; };
 
-  chunk_allocator() {
-    shares_ = new chunk_shares();
-    shares_->tail = nullptr;
-    shares_->counter = 1;
-  }
+  chunk_allocator() : chunk_allocator(chunk_options()) {}
+
+  explicit chunk_allocator(const chunk_options& options)
+      : shares_(new chunk_shares(options)) {}
 
   chunk_allocator(const chunk_allocator& other) : shares_(other.shares_) {
-    ++shares_->counter;
+    shares_->counter.fetch_add(1, std::memory_order_relaxed);
   }
 
-  chunk_allocator(const chunk_allocator&& other) = delete;
+  // rebound copies share chunks with the original allocator
+  template <typename U>
+  chunk_allocator(const chunk_allocator<U>& other) : shares_(other.shares_) {
+    shares_->counter.fetch_add(1, std::memory_order_relaxed);
+  }
 
   chunk_allocator& operator=(const chunk_allocator& other) {
-    if (this == &other) {
-      return *this;
+    if (shares_ != other.shares_) {
+      other.shares_->counter.fetch_add(1, std::memory_order_relaxed);
+      release_shares();
+      shares_ = other.shares_;
     }
-    return chunk_allocator(*this);
+    return *this;
   }
 
-  chunk_allocator&& operator=(const chunk_allocator&& other) = delete;
+  ~chunk_allocator() { release_shares(); }
 
-  ~chunk_allocator() {
-    if (--shares_->counter == 0) {
-      for (chunk* cur = shares_->tail; 
-           shares_->tail != nullptr; cur = shares_->tail) {
-        shares_->tail = cur->prev();
-        delete cur;
-      }
-      delete shares_;
-    }
+  T* allocate(std::size_t n) { return allocate_aligned(n, alignof(T)); }
+
+  void deallocate(T* p, const size_type n) {
+    deallocate_aligned(p, n, alignof(T));
   }
 
-  T* allocate(std::size_t n) {
-    if (shares_->tail == nullptr) {
-      shares_->tail = new chunk(chunk_size, nullptr);
-    }
-    auto result = shares_->tail->engage(sizeof(T) * n);
-    if (result != nullptr) {
-      return (T*)(result);
+  // allocate n objects at a multiple of alignment, e.g. a cache line for
+  // SIMD buffers; alignment must be a power of two
+  T* allocate_aligned(std::size_t n, std::size_t alignment) {
+    if (n > SIZE_MAX / sizeof(T)) {
+      throw std::bad_alloc();
     }
-
-    for (chunk* current = shares_->tail->prev(); 
-         current != nullptr; current = current->prev()) {
-      result = current->engage(sizeof(T) * n);
-      if (result != nullptr) {
-        return (T*)(result);
-      }
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+      throw std::invalid_argument("Alignment is not a power of two");
     }
-
-    shares_->tail = new chunk(chunk_size, shares_->tail);
-    result = shares_->tail->engage(sizeof(T) * n);
-    return (T*)(result);
+    return (T*)(shares_->allocate(sizeof(T) * n,
+                                  std::max(alignment, alignof(T))));
   }
 
-  void deallocate(T* p, const size_type n) {
-    uint8_t* ptr = (uint8_t*)p;
-    chunk* previous = shares_->tail;
-    for (chunk* current = previous; current != nullptr;
-         current = current->prev()) {
-      if (current->contains(ptr)) {
-        current->release(ptr, sizeof(T) * n);
-
-        if (current->empty()) {
-          if (current == shares_->tail) {
-            previous = shares_->tail->prev();
-            delete shares_->tail;
-            shares_->tail = previous;
-          } else {
-            previous->set_prev(current->prev());
-            delete current;
-          }
-        }
-
-        return;
-      }
-      previous = current;
-    }
+  void deallocate_aligned(T* p, const size_type n, std::size_t alignment) {
+    shares_->deallocate((uint8_t*)p, sizeof(T) * n,
+                        std::max(alignment, alignof(T)));
   }
 
   template <typename... Args>
@@ -245,16 +1788,29 @@ struct chunk_allocator {
 
   void destroy(T* p) { p->~T(); }
 
-  size_t chunk_count() {
-    size_t count = 0;
-    for (chunk* cur = shares_->tail; 
-         cur != nullptr; cur = cur->prev()) {
-      count += 1;
-    }
-    return count;
+  // deallocate every block of the allocator and all of its copies at once,
+  // keeping the newest chunk for the following requests
+  void reset() { shares_->reset(); }
+
+  size_t chunk_count() { return shares_->chunk_count(); }
+
+  // usage of the pool shared by the allocator and all of its copies
+  chunk_stats stats() { return shares_->stats(); }
+
+  // print the stats and a map of every chunk, width characters wide
+  void dump(std::ostream& out, size_t width = 64) {
+    shares_->dump(out, width);
   }
 
-  size_t reference_count() {
-    return shares_->counter;
+  size_t reference_count() { return shares_->counter; }
+
+  template <typename U>
+  bool operator==(const chunk_allocator<U>& other) const {
+    return shares_ == other.shares_;
+  }
+
+  template <typename U>
+  bool operator!=(const chunk_allocator<U>& other) const {
+    return shares_ != other.shares_;
   }
 };
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+#include "chunk_allocator.h"
+
+// std::pmr::memory_resource on top of the chunk pool, so std::pmr
+// containers and nested polymorphic allocators can use it. The resource
+// may share its pool with classic chunk_allocator copies.
+class chunk_memory_resource : public std::pmr::memory_resource {
+ public:
+  chunk_memory_resource() : chunk_memory_resource(chunk_options()) {}
+
+  explicit chunk_memory_resource(const chunk_options& options)
+      : allocator_(options) {}
+
+  // serve from the pool of the allocator and all of its copies
+  explicit chunk_memory_resource(const chunk_allocator<uint8_t>& allocator)
+      : allocator_(allocator) {}
+
+  chunk_memory_resource(const chunk_memory_resource&) = delete;
+  chunk_memory_resource& operator=(const chunk_memory_resource&) = delete;
+
+  // classic allocator sharing the pool with the resource
+  const chunk_allocator<uint8_t>& allocator() const { return allocator_; }
+
+  // deallocate every block of the pool at once
+  void reset() { allocator_.reset(); }
+
+  size_t chunk_count() { return allocator_.chunk_count(); }
+
+  chunk_stats stats() { return allocator_.stats(); }
+
+  void dump(std::ostream& out, size_t width = 64) {
+    allocator_.dump(out, width);
+  }
+
+ private:
+  chunk_allocator<uint8_t> allocator_;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    return allocator_.allocate_aligned(bytes, alignment);
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    allocator_.deallocate_aligned(static_cast<uint8_t*>(ptr), bytes,
+                                  alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    auto resource = dynamic_cast<const chunk_memory_resource*>(&other);
+    return resource != nullptr && resource->allocator_ == allocator_;
+  }
+};
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "chunk_allocator.h"
+
+namespace object_pool_detail {
+
+// the first block of slots takes 1 KiB, every next one is twice as large
+// up to 64 KiB
+const size_t first_block_size = 1 << 10;
+const size_t max_block_size = 1 << 16;
+
+// Slots of one size and alignment carved from blocks of the chunk pool.
+// A free slot keeps the pointer to the next free one in its first bytes,
+// slots that were never handed out are taken from the end of the newest
+// block.
+class slot_list {
+ private:
+  struct free_slot {
+    free_slot* next;
+  };
+
+  struct block {
+    uint8_t* data;
+    size_t size;
+  };
+
+  size_t size_;
+  size_t alignment_;
+  size_t block_size_ = first_block_size;
+
+  free_slot* free_ = nullptr;
+  uint8_t* next_ = nullptr;
+  uint8_t* end_ = nullptr;
+  std::vector<block> blocks_;
+
+  size_t slots_ = 0;
+  size_t free_count_ = 0;
+
+  void refill(chunk_allocator<uint8_t>& chunks) {
+    size_t size = std::max(block_size_, size_);
+    uint8_t* data = chunks.allocate_aligned(size, alignment_);
+    try {
+      blocks_.push_back({data, size});
+    } catch (...) {
+      chunks.deallocate_aligned(data, size, alignment_);
+      throw;
+    }
+    next_ = data;
+    end_ = data + size / size_ * size_;
+    slots_ += size / size_;
+    free_count_ += size / size_;
+    block_size_ = std::min(block_size_ * 2, max_block_size);
+  }
+
+ public:
+  slot_list(size_t size, size_t alignment)
+      : size_(size), alignment_(alignment) {}
+
+  size_t size() const { return size_; }
+  size_t alignment() const { return alignment_; }
+
+  // number of carved slots and of the free ones among them
+  size_t slot_count() const { return slots_; }
+  size_t free_count() const { return free_count_; }
+
+  void* pop(chunk_allocator<uint8_t>& chunks) {
+    if (free_ != nullptr) {
+      free_slot* result = free_;
+      free_ = result->next;
+      --free_count_;
+      return result;
+    }
+    if (next_ == end_) {
+      refill(chunks);
+    }
+    uint8_t* result = next_;
+    next_ += size_;
+    --free_count_;
+    return result;
+  }
+
+  void push(void* ptr) {
+    free_ = new (ptr) free_slot{free_};
+    ++free_count_;
+  }
+
+  // give all blocks back to the chunk pool, dropping every slot
+  void reset(chunk_allocator<uint8_t>& chunks) {
+    for (const block& current : blocks_) {
+      chunks.deallocate_aligned(current.data, current.size, alignment_);
+    }
+    blocks_.clear();
+    free_ = nullptr;
+    next_ = end_ = nullptr;
+    slots_ = free_count_ = 0;
+    block_size_ = first_block_size;
+  }
+};
+
+// Slot lists of one pool and its copies, rebound ones included, with
+// the chunk allocator they take blocks from.
+struct slot_store {
+  explicit slot_store(const chunk_allocator<uint8_t>& chunks)
+      : chunks(chunks) {}
+
+  slot_store(const slot_store&) = delete;
+  slot_store& operator=(const slot_store&) = delete;
+
+  ~slot_store() { reset(); }
+
+  // slot list for the size and alignment, created on the first request
+  slot_list* find(size_t size, size_t alignment) {
+    for (slot_list& current : lists) {
+      if (current.size() == size && current.alignment() == alignment) {
+        return &current;
+      }
+    }
+    lists.emplace_back(size, alignment);
+    return &lists.back();
+  }
+
+  void reset() {
+    for (slot_list& current : lists) {
+      current.reset(chunks);
+    }
+  }
+
+  size_t counter = 1;
+  chunk_allocator<uint8_t> chunks;
+  // a list keeps the addresses the pools hold stable
+  std::list<slot_list> lists;
+};
+
+}  // namespace object_pool_detail
+
+// Allocator of single objects of one type in fixed slots of the chunk
+// pool. Freed slots are reused in LIFO order without searching the
+// chunks, so the pool suits the nodes of std::list, std::map and
+// std::unordered_map; arrays (e.g. the buckets of std::unordered_map) go
+// to the chunk pool directly. Rebound copies share the pool and each
+// slot size gets its own free list. Like the default chunk_allocator,
+// the pool and all of its copies may be used from one thread at a time.
+template <typename T>
+class object_pool {
+ private:
+  template <typename U>
+  friend class object_pool;
+
+  using slot_store = object_pool_detail::slot_store;
+  using slot_list = object_pool_detail::slot_list;
+
+  // a slot holds the object or the free list link
+  static constexpr size_t slot_alignment =
+      std::max(alignof(T), alignof(void*));
+  static constexpr size_t slot_size =
+      (std::max(sizeof(T), sizeof(void*)) + slot_alignment - 1) /
+      slot_alignment * slot_alignment;
+
+  slot_store* store_;
+  slot_list* slots_;
+
+  // GCC 12 follows one copy deleting the store and another one reading
+  // its counter afterwards, not knowing that only the last copy deletes
+  // it; the copies std::list makes in its constructor trigger this
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuse-after-free"
+#endif
+  // the store is either deleted by the last pool or decremented, and is
+  // never touched through this pool afterwards
+  void release_store() {
+    slot_store* store = std::exchange(store_, nullptr);
+    if (store->counter == 1) {
+      delete store;
+    } else {
+      --store->counter;
+    }
+  }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic pop
+#endif
+
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using reference = T&;
+  using const_reference = const T&;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  template <typename U>
+  struct rebind { typedef object_pool<U> other; };
+
+  object_pool() : object_pool(chunk_options()) {}
+
+  explicit object_pool(const chunk_options& options)
+      : object_pool(chunk_allocator<uint8_t>(options)) {}
+
+  // carve slots from the pool of the allocator and all of its copies
+  explicit object_pool(const chunk_allocator<uint8_t>& chunks)
+      : store_(new slot_store(chunks)),
+        slots_(store_->find(slot_size, slot_alignment)) {}
+
+  object_pool(const object_pool& other)
+      : store_(other.store_), slots_(other.slots_) {
+    ++store_->counter;
+  }
+
+  // rebound copies share the slots of the same size with the original
+  template <typename U>
+  object_pool(const object_pool<U>& other)
+      : store_(other.store_),
+        slots_(store_->find(slot_size, slot_alignment)) {
+    ++store_->counter;
+  }
+
+  object_pool& operator=(const object_pool& other) {
+    if (store_ != other.store_) {
+      ++other.store_->counter;
+      release_store();
+      store_ = other.store_;
+      slots_ = other.slots_;
+    }
+    return *this;
+  }
+
+  ~object_pool() { release_store(); }
+
+  T* allocate(std::size_t n) {
+    if (n == 1) {
+      return static_cast<T*>(slots_->pop(store_->chunks));
+    }
+    if (n > SIZE_MAX / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    return reinterpret_cast<T*>(
+        store_->chunks.allocate_aligned(sizeof(T) * n, alignof(T)));
+  }
+
+  void deallocate(T* p, const size_type n) {
+    if (n == 1) {
+      slots_->push(p);
+      return;
+    }
+    store_->chunks.deallocate_aligned(reinterpret_cast<uint8_t*>(p),
+                                      sizeof(T) * n, alignof(T));
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    new ((void*)p) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  void destroy(U* p) {
+    p->~U();
+  }
+
+  // allocate a slot and construct the object in it
+  template <typename... Args>
+  T* new_object(Args&&... args) {
+    T* p = allocate(1);
+    try {
+      construct(p, std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(p, 1);
+      throw;
+    }
+    return p;
+  }
+
+  void delete_object(T* p) {
+    destroy(p);
+    deallocate(p, 1);
+  }
+
+  // drop every slot of the pool and all of its copies at once, giving
+  // their blocks back to the chunk pool; objects are not destroyed
+  void reset() { store_->reset(); }
+
+  // slots of the size of T carved so far and the free ones among them
+  size_t slot_count() const { return slots_->slot_count(); }
+  size_t free_count() const { return slots_->free_count(); }
+
+  // chunk allocator the slots are carved from
+  const chunk_allocator<uint8_t>& allocator() const { return store_->chunks; }
+
+  size_t reference_count() const { return store_->counter; }
+
+  template <typename U>
+  bool operator==(const object_pool<U>& other) const {
+    return store_ == other.store_;
+  }
+
+  template <typename U>
+  bool operator!=(const object_pool<U>& other) const {
+    return store_ != other.store_;
+  }
+};
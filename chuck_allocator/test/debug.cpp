@@ -0,0 +1,123 @@
+// Tests of the hardened mode, built with -DCHUNK_ALLOCATOR_DEBUG
+
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/chunk_allocator.h"
+
+using namespace std;
+
+void FailWithMsg(const std::string& msg, int line) {
+  std::cerr << "Test failed!\n";
+  std::cerr << "[Line " << line << "] " << msg << std::endl;
+  std::exit(EXIT_FAILURE);
+}
+
+#define ASSERT_TRUE(cond)                              \
+  if (!(cond)) {                                       \
+    FailWithMsg("Assertion failed: " #cond, __LINE__); \
+  };
+
+#define ASSERT_EXCEPTION_MSG(cond, ex, msg) \
+    {bool ok = false;                       \
+    try {(cond);} catch (const ex&) {ok = true;} catch (...) {} \
+    if (!ok) FailWithMsg(msg, __LINE__);}
+
+int main() {
+  using chunk_detail::block_guard;
+
+  // Fresh blocks test
+  {
+    chunk_allocator<uint8_t> allocator;
+    uint8_t* block = allocator.allocate(13);
+    for (size_t i = 0; i < 13; ++i) {
+      ASSERT_TRUE(block[i] == block_guard::fresh_byte);
+    }
+    allocator.deallocate(block, 13);
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
+  // Double free test
+  {
+    chunk_allocator<int> allocator;
+    int* small = allocator.allocate(4);
+    int* large = allocator.allocate(1000);
+    allocator.deallocate(small, 4);
+    allocator.deallocate(large, 1000);
+    ASSERT_EXCEPTION_MSG(allocator.deallocate(small, 4), invalid_argument,
+                         "Double free of a cached block is not detected");
+    ASSERT_EXCEPTION_MSG(allocator.deallocate(large, 1000), invalid_argument,
+                         "Double free of a released block is not detected");
+  }
+
+  // Mismatched deallocation test
+  {
+    chunk_allocator<int> allocator;
+    int* block = allocator.allocate(10);
+    ASSERT_EXCEPTION_MSG(allocator.deallocate(block, 9), invalid_argument,
+                         "Wrong size is not detected");
+    ASSERT_EXCEPTION_MSG(allocator.deallocate_aligned(block, 10, 64),
+                         invalid_argument, "Wrong alignment is not detected");
+    int local = 0;
+    ASSERT_EXCEPTION_MSG(allocator.deallocate(&local, 1), invalid_argument,
+                         "Foreign block is not detected");
+    allocator.deallocate(block, 10);
+
+    int* aligned = allocator.allocate_aligned(3, 256);
+    ASSERT_TRUE(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+    allocator.deallocate_aligned(aligned, 3, 256);
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
+#ifndef CHUNK_ALLOCATOR_ASAN
+  // Overrun test; AddressSanitizer reports these writes by itself
+  {
+    chunk_allocator<uint8_t> allocator;
+    uint8_t* after = allocator.allocate(13);
+    after[13] = 0;
+    ASSERT_EXCEPTION_MSG(allocator.deallocate(after, 13), runtime_error,
+                         "Overrun is not detected");
+
+    uint8_t* before = allocator.allocate_aligned(8, 64);
+    before[-20] = 0;
+    ASSERT_EXCEPTION_MSG(allocator.deallocate_aligned(before, 8, 64),
+                         runtime_error, "Underrun is not detected");
+  }
+#endif
+
+  // Containers test
+  {
+    chunk_options options;
+    options.concurrent = true;
+    chunk_allocator<int> allocator(options);
+    vector<thread> workers;
+    for (int t = 0; t < 4; ++t) {
+      workers.emplace_back([&allocator] {
+        list<int, chunk_allocator<int>> lst(allocator);
+        map<int, string, less<int>, chunk_allocator<pair<const int, string>>>
+            dict(allocator);
+        for (int i = 0; i < 1000; ++i) {
+          lst.push_back(i);
+          dict.emplace(i, "a string too long for the small buffer");
+        }
+        for (int i = 0; i < 1000; i += 2) {
+          dict.erase(i);
+        }
+        ASSERT_TRUE(lst.size() == 1000 && dict.size() == 500);
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
+  cout << "All tests passed!" << endl;
+  return 0;
+}
@@ -1,11 +1,17 @@
 #include <string>
 #include <list>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <typeinfo>
+#include <sstream>
+#include <thread>
 
 #include "../src/chunk_allocator.h"
+#include "../src/chunk_memory_resource.h"
+#include "../src/object_pool.h"
 
 using namespace std;
 
@@ -122,6 +128,10 @@ class LinkedList {
 int main(int argc, char** argv) {
   const size_t CHUNK_SIZE = (1 << 12);
 
+  // chunks that do not grow, so the tests can count them
+  chunk_options fixed;
+  fixed.max_chunk_size = CHUNK_SIZE;
+
   // Member types tests
   {
     ASSERT_TRUE(typeid(chunk_allocator<int>::value_type) == typeid(int));
@@ -188,15 +198,180 @@ int main(int argc, char** argv) {
     }
   }
 
-  // Bad allocation test
+  // Large objects test
   {
-    chunk_allocator<uint8_t> allocator;
-    ASSERT_EXCEPTION_MSG(allocator.allocate(CHUNK_SIZE + 1), out_of_range, "allocate");
+    chunk_allocator<uint8_t> allocator(fixed);
+
+    auto a1 = allocator.allocate(8);
+    // larger than any chunk, gets a dedicated one
+    auto a2 = allocator.allocate(CHUNK_SIZE + 1);
+    FILL(a2, 1, CHUNK_SIZE + 1);
+    ASSERT_TRUE(allocator.chunk_count() == 2);
+    // does not go to the dedicated chunk
+    auto a3 = allocator.allocate(CHUNK_SIZE / 2);
+    ASSERT_TRUE(allocator.chunk_count() == 2);
+
+    allocator.deallocate(a2, CHUNK_SIZE + 1);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    allocator.deallocate(a1, 8);
+    allocator.deallocate(a3, CHUNK_SIZE / 2);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+
+    chunk_allocator<uint8_t> huge;
+    ASSERT_EXCEPTION_MSG(huge.allocate(SIZE_MAX - 1), bad_alloc, "allocate");
+  }
+
+  // Chunks growth test
+  {
+    chunk_options options;
+    options.chunk_size = CHUNK_SIZE;
+    options.max_chunk_size = 4 * CHUNK_SIZE;
+    chunk_allocator<uint8_t> allocator(options);
+
+    // chunks of 4, 8, 16, 16 KiB
+    auto a1 = allocator.allocate(CHUNK_SIZE);
+    auto a2 = allocator.allocate(2 * CHUNK_SIZE);
+    auto a3 = allocator.allocate(4 * CHUNK_SIZE);
+    auto a4 = allocator.allocate(CHUNK_SIZE);
+    ASSERT_TRUE(allocator.chunk_count() == 4);
+    auto a5 = allocator.allocate(3 * CHUNK_SIZE);
+    ASSERT_TRUE(allocator.chunk_count() == 4);
+
+    allocator.deallocate(a1, CHUNK_SIZE);
+    allocator.deallocate(a2, 2 * CHUNK_SIZE);
+    allocator.deallocate(a3, 4 * CHUNK_SIZE);
+    allocator.deallocate(a4, CHUNK_SIZE);
+    allocator.deallocate(a5, 3 * CHUNK_SIZE);
+    // the first chunk to get empty is kept as the spare
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+
+    // growth follows the live chunks, so it starts over
+    auto a6 = allocator.allocate(CHUNK_SIZE);
+    auto a7 = allocator.allocate(CHUNK_SIZE);
+    ASSERT_TRUE(allocator.stats().chunks[0].size == CHUNK_SIZE);
+    ASSERT_TRUE(allocator.stats().chunks[1].size == 2 * CHUNK_SIZE);
+    allocator.deallocate(a6, CHUNK_SIZE);
+    allocator.deallocate(a7, CHUNK_SIZE);
+
+    // containers of any size
+    vector<int, chunk_allocator<int>> vec(allocator);
+    for (int i = 0; i < 100000; ++i) {
+      vec.push_back(i);
+    }
+    ASSERT_TRUE(vec[99999] == 99999);
+  }
+
+  // Mapped chunks test
+  for (auto backing : {chunk_backing::mmap, chunk_backing::huge_pages}) {
+    chunk_options options = fixed;
+    options.backing = backing;
+    chunk_allocator<uint8_t> allocator(options);
+
+    // huge page chunks are never smaller than a huge page
+    const size_t size = backing == chunk_backing::huge_pages
+                            ? chunk_detail::huge_page_size
+                            : CHUNK_SIZE;
+    auto a1 = allocator.allocate(size);
+    FILL(a1, 0xff, size);
+    auto a2 = allocator.allocate(4 * size);
+    FILL(a2, 0xff, 4 * size);
+    ASSERT_TRUE(allocator.chunk_count() == 2);
+    if (backing == chunk_backing::huge_pages) {
+      // the data starts at a huge page, so all of its pages can be freed
+      ASSERT_TRUE(reinterpret_cast<uintptr_t>(a1) % size == 0);
+    }
+
+    // dedicated chunks are unmapped, the regular ones are kept
+    allocator.deallocate(a2, 4 * size);
+    allocator.deallocate(a1, size);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+
+    auto a3 = allocator.allocate(size);
+    ASSERT_TRUE(a3 == a1);
+    FILL(a3, 1, size);
+    allocator.deallocate(a3, size);
+  }
+
+  // Spare chunk test
+  {
+    chunk_options options = fixed;
+    options.backing = chunk_backing::mmap;
+    chunk_allocator<uint8_t> allocator(options);
+    auto a1 = allocator.allocate(CHUNK_SIZE);
+    FILL(a1, 1, CHUNK_SIZE);
+    allocator.deallocate(a1, CHUNK_SIZE);
+
+    // the emptied chunk is kept as it is, its pages are not given back
+    REPEAT(100) {
+      auto a2 = allocator.allocate(CHUNK_SIZE);
+      ASSERT_TRUE(a2 == a1 && a2[CHUNK_SIZE / 2] == 1);
+      allocator.deallocate(a2, CHUNK_SIZE);
+    }
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+  }
+
+  // Default sized huge page chunks test
+  {
+    chunk_options options;
+    options.backing = chunk_backing::huge_pages;
+    chunk_allocator<uint8_t> allocator(options);
+    vector<uint8_t*> blocks;
+    for (size_t i = 0; i < 1000; ++i) {
+      blocks.push_back(allocator.allocate(1000));
+    }
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    for (uint8_t* block : blocks) {
+      allocator.deallocate(block, 1000);
+    }
+  }
+
+  // Monotonic allocator test
+  {
+    chunk_options options = fixed;
+    options.monotonic = true;
+    chunk_allocator<uint64_t> allocator(options);
+
+    auto a1 = allocator.allocate(1);
+    auto a2 = allocator.allocate(2);
+    ASSERT_TRUE(a2 == a1 + 1);
+    allocator.deallocate(a1, 1);
+    ASSERT_TRUE(allocator.allocate(1) == a2 + 2);
+
+    {
+      vector<uint64_t, chunk_allocator<uint64_t>> vec(allocator);
+      for (uint64_t i = 0; i < 10000; ++i) {
+        vec.push_back(i);
+      }
+    }
+    ASSERT_TRUE(allocator.chunk_count() > 2);
+
+    allocator.reset();
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    auto a3 = allocator.allocate(CHUNK_SIZE / sizeof(uint64_t));
+    auto a4 = allocator.allocate(1);
+    ASSERT_TRUE(allocator.chunk_count() == 2);
+    ASSERT_TRUE(a4 != a3 + CHUNK_SIZE / sizeof(uint64_t));
+  }
+
+  // Reset test
+  {
+    chunk_allocator<uint8_t> allocator(fixed);
+    REPEAT(10) { allocator.allocate(CHUNK_SIZE / 2 + 1); }
+    REPEAT(10) { allocator.allocate(16); }
+    ASSERT_TRUE(allocator.chunk_count() == 10);
+
+    allocator.reset();
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    auto a1 = allocator.allocate(CHUNK_SIZE);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    // and stays as the spare
+    allocator.deallocate(a1, CHUNK_SIZE);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
   }
 
   // Chunks chain test
   {
-    chunk_allocator<uint8_t> allocator;
+    chunk_allocator<uint8_t> allocator(fixed);
 
     auto* a0 = allocator.allocate(8);
 
@@ -206,24 +381,97 @@ int main(int argc, char** argv) {
     auto a2 = allocator.allocate(CHUNK_SIZE / 2);
     // third chunk
     auto a3 = allocator.allocate(CHUNK_SIZE / 2);
-    // third chunk (tail)
+    // first chunk, the best fit
     auto a4 = allocator.allocate(16);
-    // first chunk
+    // third chunk
     auto a5 = allocator.allocate(CHUNK_SIZE / 2 - 8);
 
     ASSERT_TRUE(allocator.chunk_count() == 3);
 
     allocator.deallocate(a1, CHUNK_SIZE);
-    ASSERT_TRUE(allocator.chunk_count() == 2);
+    // the emptied second chunk is kept as the spare
+    ASSERT_TRUE(allocator.chunk_count() == 3);
 
     allocator.deallocate(a0, 8);
     allocator.deallocate(a2, CHUNK_SIZE / 2);
     allocator.deallocate(a4, 16);
-    ASSERT_TRUE(allocator.chunk_count() == 1);
+    // the parked a0 and a4 keep the first chunk
+    ASSERT_TRUE(allocator.chunk_count() == 3);
 
+    // there is a spare already, so the third chunk goes
     allocator.deallocate(a3, CHUNK_SIZE / 2);
     allocator.deallocate(a5, CHUNK_SIZE / 2 - 8);
-    ASSERT_TRUE(allocator.chunk_count() == 0);
+    ASSERT_TRUE(allocator.chunk_count() == 2);
+  }
+
+  // Coalescing test
+  {
+    chunk_allocator<uint8_t> allocator(fixed);
+    vector<uint8_t*> blocks;
+    REPEAT(4) { blocks.push_back(allocator.allocate(CHUNK_SIZE / 4)); }
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+
+    allocator.deallocate(blocks[1], CHUNK_SIZE / 4);
+    allocator.deallocate(blocks[2], CHUNK_SIZE / 4);
+    // the freed neighbours make one run
+    ASSERT_TRUE(allocator.stats().largest_free == CHUNK_SIZE / 2);
+    auto a1 = allocator.allocate(CHUNK_SIZE / 2);
+    ASSERT_TRUE(a1 == blocks[1] && allocator.chunk_count() == 1);
+
+    allocator.deallocate(a1, CHUNK_SIZE / 2);
+    allocator.deallocate(blocks[0], CHUNK_SIZE / 4);
+    allocator.deallocate(blocks[3], CHUNK_SIZE / 4);
+
+    // steady churn of mixed sizes does not keep adding chunks
+    vector<pair<uint8_t*, size_t>> live(256);
+    size_t most = 0;
+    for (size_t i = 0; i < 100000; ++i) {
+      auto& block = live[(i * 7919) % live.size()];
+      if (block.first != nullptr) {
+        allocator.deallocate(block.first, block.second);
+      }
+      block.second = 8 + (i * 104729) % 1024;
+      block.first = allocator.allocate(block.second);
+      if (i == live.size() * 4) {
+        most = allocator.chunk_count();
+      }
+    }
+    ASSERT_TRUE(allocator.chunk_count() <= most + most / 4);
+    for (auto& block : live) {
+      allocator.deallocate(block.first, block.second);
+    }
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
+  // Free runs index test
+  {
+    chunk_allocator<uint8_t> allocator(fixed);
+    auto* a0 = allocator.allocate(512);
+    auto* a1 = allocator.allocate(256);
+    auto* a2 = allocator.allocate(256);
+    auto* a3 = allocator.allocate(256);
+    allocator.deallocate(a0, 512);
+    allocator.deallocate(a2, 256);
+
+    // the shortest free run that fits is taken, not the first one
+    auto* b0 = allocator.allocate(256);
+    ASSERT_TRUE(b0 == a2);
+    auto* b1 = allocator.allocate(512);
+    ASSERT_TRUE(b1 == a0);
+
+    // a run too short for the request at any alignment is still taken
+    // when it starts at one that fits
+    auto* rest = allocator.allocate(CHUNK_SIZE - 1280);
+    allocator.deallocate(b1, 512);
+    auto* b2 = allocator.allocate_aligned(480, 64);
+    ASSERT_TRUE(b2 == a0 && allocator.chunk_count() == 1);
+
+    allocator.deallocate_aligned(b2, 480, 64);
+    allocator.deallocate(rest, CHUNK_SIZE - 1280);
+    allocator.deallocate(b0, 256);
+    allocator.deallocate(a1, 256);
+    allocator.deallocate(a3, 256);
+    ASSERT_TRUE(allocator.chunk_count() == 1);
   }
 
   // Construction test
@@ -262,7 +510,7 @@ int main(int argc, char** argv) {
 
   // Reference counting
   {
-    chunk_allocator<uint8_t> allocator1;
+    chunk_allocator<uint8_t> allocator1(fixed);
     uint8_t* a1 = allocator1.allocate(CHUNK_SIZE / 2 + 1);
 
     auto allocator2(allocator1);
@@ -297,7 +545,8 @@ int main(int argc, char** argv) {
     allocator5.deallocate(a5, CHUNK_SIZE / 2 + 1);
     allocator4.deallocate(a4, CHUNK_SIZE / 2 + 1);
 
-    ASSERT_TRUE(allocator1.chunk_count() == 3);
+    // a1 to a3 keep their chunks, the first one emptied is the spare
+    ASSERT_TRUE(allocator1.chunk_count() == 4);
     ASSERT_TRUE(allocator1.reference_count() == 3);
 
     auto allocptr = new chunk_allocator<uint8_t>(allocator1);
@@ -316,6 +565,320 @@ int main(int argc, char** argv) {
     lst.Resize(8, 1);
   }
 
+  // Size classes test
+  {
+    chunk_allocator<uint8_t> allocator;
+
+    vector<uint8_t*> blocks;
+    REPEAT(16) { blocks.push_back(allocator.allocate(24)); }
+    auto big = allocator.allocate(1024);
+
+    for (auto block : blocks) {
+      allocator.deallocate(block, 24);
+    }
+    // freed blocks are handed out again in LIFO order
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      ASSERT_TRUE(allocator.allocate(24) == *it);
+    }
+
+    for (auto block : blocks) {
+      allocator.deallocate(block, 24);
+    }
+    allocator.deallocate(big, 1024);
+    // the parked blocks keep their chunk until they are needed elsewhere
+    ASSERT_TRUE(allocator.chunk_count() == 1);
+    ASSERT_TRUE(allocator.stats().bytes_cached == 16 * 24);
+  }
+
+  // Owner lookup test
+  {
+    chunk_allocator<uint8_t> allocator1(fixed);
+    chunk_allocator<uint8_t> allocator2(fixed);
+
+    vector<uint8_t*> blocks;
+    REPEAT(2000) { blocks.push_back(allocator1.allocate(CHUNK_SIZE / 2 + 1)); }
+    ASSERT_TRUE(allocator1.chunk_count() == 2000);
+
+    // foreign pointers are ignored
+    allocator2.deallocate(blocks[0], CHUNK_SIZE / 2 + 1);
+    ASSERT_TRUE(allocator1.chunk_count() == 2000);
+
+    for (auto block : blocks) {
+      allocator1.deallocate(block, CHUNK_SIZE / 2 + 1);
+    }
+    ASSERT_TRUE(allocator1.chunk_count() == 1);
+  }
+
+  // STL containers test
+  {
+    chunk_allocator<int> allocator;
+    list<int, chunk_allocator<int>> lst(allocator);
+    vector<int, chunk_allocator<int>> vec(allocator);
+    for (int i = 0; i < 100; ++i) {
+      lst.push_back(i);
+      vec.push_back(i);
+    }
+    ASSERT_TRUE(lst.get_allocator() == allocator);
+    ASSERT_TRUE(allocator.reference_count() == 3);
+    ASSERT_TRUE(lst.back() == 99 && vec.back() == 99);
+
+    lst.clear();
+    vec = vector<int, chunk_allocator<int>>(allocator);
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
+  // Alignment test
+  {
+    struct alignas(32) Vector {
+      double lanes[4];
+    };
+    struct alignas(64) CacheLine {
+      uint8_t bytes[64];
+    };
+    auto aligned = [](const void* ptr, size_t alignment) {
+      return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+    };
+
+    for (bool monotonic : {false, true}) {
+      chunk_options options;
+      options.monotonic = monotonic;
+      chunk_allocator<uint8_t> bytes(options);
+      chunk_allocator<double> doubles(bytes);
+      chunk_allocator<Vector> vectors(bytes);
+      chunk_allocator<CacheLine> lines(bytes);
+
+      vector<pair<void*, size_t>> blocks;
+      for (size_t i = 1; i < 200; ++i) {
+        uint8_t* b = bytes.allocate(i % 7 + 1);
+        double* d = doubles.allocate(i % 5 + 1);
+        Vector* v = vectors.allocate(i % 3 + 1);
+        CacheLine* l = lines.allocate(1);
+        uint8_t* page = bytes.allocate_aligned(i, 4096);
+        ASSERT_TRUE(aligned(d, alignof(double)));
+        ASSERT_TRUE(aligned(v, 32) && aligned(l, 64) && aligned(page, 4096));
+        FILL(l->bytes, 1, 64);
+        FILL(page, 2, i);
+
+        if (i % 2 == 0) {
+          bytes.deallocate(b, i % 7 + 1);
+          doubles.deallocate(d, i % 5 + 1);
+          vectors.deallocate(v, i % 3 + 1);
+          lines.deallocate(l, 1);
+          bytes.deallocate_aligned(page, i, 4096);
+        }
+      }
+      if (!monotonic) {
+        bytes.reset();
+      }
+    }
+
+    chunk_allocator<uint8_t> allocator(fixed);
+    // over the chunk size after padding for the alignment
+    auto a1 = allocator.allocate_aligned(CHUNK_SIZE, 2 * CHUNK_SIZE);
+    ASSERT_TRUE(aligned(a1, 2 * CHUNK_SIZE));
+    allocator.deallocate_aligned(a1, CHUNK_SIZE, 2 * CHUNK_SIZE);
+    ASSERT_TRUE(allocator.chunk_count() == 0);
+    ASSERT_EXCEPTION_MSG(allocator.allocate_aligned(8, 24), invalid_argument,
+                         "allocate_aligned");
+
+    vector<CacheLine, chunk_allocator<CacheLine>> vec(allocator);
+    vec.resize(100);
+    ASSERT_TRUE(aligned(vec.data(), 64));
+  }
+
+  // Stats test
+  {
+    chunk_allocator<uint8_t> allocator(fixed);
+    auto a1 = allocator.allocate(CHUNK_SIZE / 4);
+    auto a2 = allocator.allocate(CHUNK_SIZE / 4);
+    auto a3 = allocator.allocate(CHUNK_SIZE / 4);
+    auto a4 = allocator.allocate(16);
+    auto a5 = allocator.allocate(2 * CHUNK_SIZE);
+    allocator.deallocate(a2, CHUNK_SIZE / 4);
+    allocator.deallocate(a4, 16);
+
+    chunk_stats stats = allocator.stats();
+    ASSERT_TRUE(stats.chunks.size() == 2);
+    ASSERT_TRUE(stats.chunks[0].size == CHUNK_SIZE);
+    ASSERT_TRUE(stats.chunks[0].fill() == 0.5 + 16.0 / CHUNK_SIZE);
+    ASSERT_TRUE(stats.chunks[0].fragments == 2);
+    ASSERT_TRUE(stats.chunks[1].large);
+    ASSERT_TRUE(stats.bytes_reserved == 3 * CHUNK_SIZE);
+    ASSERT_TRUE(stats.bytes_in_use == CHUNK_SIZE / 2 + 2 * CHUNK_SIZE);
+    ASSERT_TRUE(stats.bytes_cached == 16);
+    ASSERT_TRUE(stats.bytes_free == CHUNK_SIZE / 2 - 16);
+    ASSERT_TRUE(stats.largest_free == CHUNK_SIZE / 4);
+    ASSERT_TRUE(stats.fragments == 2);
+    ASSERT_TRUE(stats.allocations == 5 && stats.deallocations == 2);
+    ASSERT_TRUE(stats.fragmentation() > 0 && stats.fragmentation() < 1);
+
+    ostringstream dump;
+    allocator.dump(dump, 8);
+    ASSERT_TRUE(dump.str().find("[##..##+.]") != string::npos);
+    ASSERT_TRUE(dump.str().find("large") != string::npos);
+
+    allocator.deallocate(a1, CHUNK_SIZE / 4);
+    allocator.deallocate(a3, CHUNK_SIZE / 4);
+    allocator.deallocate(a5, 2 * CHUNK_SIZE);
+    stats = allocator.stats();
+    // the parked a4 keeps the regular chunk
+    ASSERT_TRUE(stats.chunks.size() == 1 && stats.bytes_in_use == 0);
+    ASSERT_TRUE(stats.bytes_cached == 16);
+  }
+
+  // Memory resource test
+  {
+    chunk_allocator<uint8_t> allocator;
+    chunk_memory_resource resource(allocator);
+    ASSERT_TRUE(resource.allocator() == allocator);
+
+    {
+      pmr::vector<int> vec(&resource);
+      pmr::map<int, pmr::string> dict(&resource);
+      for (int i = 0; i < 1000; ++i) {
+        vec.push_back(i);
+        dict.emplace(i, "a string too long for the small buffer");
+      }
+      ASSERT_TRUE(vec[999] == 999 && dict.size() == 1000);
+      ASSERT_TRUE(dict.get_allocator().resource() == &resource);
+      ASSERT_TRUE(dict[1].get_allocator().resource() == &resource);
+      ASSERT_TRUE(allocator.chunk_count() > 0);
+    }
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+
+    void* aligned = resource.allocate(100, 256);
+    ASSERT_TRUE(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+    resource.deallocate(aligned, 100, 256);
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+
+    chunk_memory_resource shared(allocator);
+    chunk_memory_resource other;
+    ASSERT_TRUE(resource.is_equal(shared));
+    ASSERT_TRUE(!resource.is_equal(other));
+    ASSERT_TRUE(!resource.is_equal(*pmr::new_delete_resource()));
+  }
+
+  // Object pool test
+  {
+    chunk_allocator<uint8_t> chunks;
+    {
+      object_pool<Foo> pool(chunks);
+      Foo* first = pool.new_object(1, 2.0);
+      ASSERT_TRUE(first->a == 1 && first->d == 2.0);
+      pool.delete_object(first);
+      // the freed slot is the first to be reused
+      Foo* second = pool.new_object(3);
+      ASSERT_TRUE(second == first && second->a == 3);
+      ASSERT_TRUE(pool.free_count() == pool.slot_count() - 1);
+
+      vector<Foo*> objects;
+      REPEAT(1000) {
+        objects.push_back(pool.new_object(int(_iter)));
+      }
+      for (size_t i = 0; i < objects.size(); ++i) {
+        ASSERT_TRUE(objects[i]->a == int(i));
+        ASSERT_TRUE(reinterpret_cast<uintptr_t>(objects[i]) % alignof(Foo) ==
+                    0);
+        pool.delete_object(objects[i]);
+      }
+      size_t slots = pool.slot_count();
+      ASSERT_TRUE(pool.free_count() == slots - 1);
+      REPEAT(1000) {
+        objects[_iter] = pool.allocate(1);
+      }
+      ASSERT_TRUE(pool.slot_count() == slots);
+
+      // rebound copies share the pool, arrays go to the chunks directly
+      object_pool<double> doubles(pool);
+      ASSERT_TRUE(doubles == pool && pool.reference_count() == 2);
+      double* array = doubles.allocate(100);
+      FILL(array, 1.5, 100);
+      doubles.deallocate(array, 100);
+
+      pool.reset();
+      ASSERT_TRUE(pool.slot_count() == 0);
+      ASSERT_TRUE(chunks.stats().bytes_in_use == 0);
+    }
+
+    {
+      object_pool<int> pool(chunks);
+      list<int, object_pool<int>> lst(pool);
+      map<int, int, less<int>, object_pool<pair<const int, int>>> dict(pool);
+      unordered_map<int, string, hash<int>, equal_to<int>,
+                    object_pool<pair<const int, string>>>
+          table(0, hash<int>(), equal_to<int>(), pool);
+      LinkedList<int, object_pool<int>> linked;
+      for (int i = 0; i < 1000; ++i) {
+        lst.push_back(i);
+        dict[i] = i;
+        table.emplace(i, "a string too long for the small buffer");
+        linked.Add(i);
+      }
+      for (int i = 0; i < 1000; i += 2) {
+        dict.erase(i);
+        table.erase(i);
+        linked.Remove(i);
+      }
+      ASSERT_TRUE(lst.size() == 1000 && lst.back() == 999);
+      ASSERT_TRUE(dict.size() == 500 && dict[999] == 999);
+      ASSERT_TRUE(table.size() == 500 && table.count(999) == 1);
+      ASSERT_TRUE(table.get_allocator() == pool);
+      ASSERT_TRUE(pool.reference_count() > 1);
+    }
+    // the last copy gives the slots back
+    ASSERT_TRUE(chunks.stats().bytes_in_use == 0);
+  }
+
+  // Concurrent allocator test
+  {
+    chunk_options options;
+    options.concurrent = true;
+    chunk_allocator<int> allocator(options);
+
+    const size_t threads = 4;
+    vector<vector<int*>> handed(threads);
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        // every copy is made and dropped concurrently with the others
+        chunk_allocator<int> local(allocator);
+        list<int, chunk_allocator<int>> lst(local);
+        for (size_t i = 0; i < 2000; ++i) {
+          int* block = local.allocate(1 + i % 40);
+          block[0] = t;
+          if (i % 2 == 0) {
+            handed[t].push_back(block);
+          } else {
+            local.deallocate(block, 1 + i % 40);
+          }
+          lst.push_back(i);
+        }
+        ASSERT_TRUE(lst.size() == 2000);
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    ASSERT_TRUE(allocator.reference_count() == 1);
+
+    // blocks are freed by other threads than the ones allocated them
+    workers.clear();
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+        auto& blocks = handed[(t + 1) % threads];
+        for (size_t i = 0; i < blocks.size(); ++i) {
+          ASSERT_TRUE(size_t(blocks[i][0]) == (t + 1) % threads);
+          allocator.deallocate(blocks[i], 1 + (2 * i) % 40);
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    // exited threads return their caches
+    ASSERT_TRUE(allocator.stats().bytes_in_use == 0);
+  }
+
   cout << "All tests passed!" << endl;
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+set -e
+
+g++ -std=c++17 -O2 -pthread -I./ bench/bandwidth.cpp -o matrix_bandwidth
+g++ -std=c++17 -O2 -pthread -I./ bench/summation.cpp -o matrix_summation
+./matrix_bandwidth "$@"
+./matrix_summation
+
+rm matrix_bandwidth matrix_summation
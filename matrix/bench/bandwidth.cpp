@@ -0,0 +1,57 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../src/matrix.cpp"
+
+using task::Matrix;
+
+// Gigabytes per second moved by `a += b` (two reads and one write)
+double MeasureBandwidth(Matrix& a, const Matrix& b, int repeats) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeats; ++i) {
+    a += b;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double bytes = 3.0 * sizeof(double) * a.rows() * a.cols() * repeats;
+  return bytes / elapsed.count() / 1e9;
+}
+
+int main(int argc, char** argv) {
+  const size_t size = argc > 1 ? std::stoul(argv[1]) : 4096;
+  const size_t threads = argc > 2 ? std::stoul(argv[2])
+                                  : std::thread::hardware_concurrency();
+  const int repeats = 10;
+
+  std::cout << "Matrix " << size << " x " << size << ", " << threads
+            << " threads\n";
+  std::cout << std::fixed << std::setprecision(2);
+
+  {
+    // Everything is touched by the main thread, i.e. lives on its node
+    task::SetThreadCount(1);
+    Matrix a(size, size), b(size, size);
+    std::cout << "serial placement, 1 thread:        "
+              << MeasureBandwidth(a, b, repeats) << " GB/s\n";
+    task::SetThreadCount(threads, false);
+    std::cout << "serial placement, unpinned pool:   "
+              << MeasureBandwidth(a, b, repeats) << " GB/s\n";
+    task::SetThreadCount(threads, true);
+    std::cout << "serial placement, pinned pool:     "
+              << MeasureBandwidth(a, b, repeats) << " GB/s\n";
+  }
+
+  {
+    // Every band of rows is touched by the pinned worker processing it
+    task::SetThreadCount(threads, true);
+    Matrix a(size, size), b(size, size);
+    std::cout << "first-touch placement, pinned pool: "
+              << MeasureBandwidth(a, b, repeats) << " GB/s\n";
+  }
+
+  return 0;
+}
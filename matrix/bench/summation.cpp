@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../src/matrix.cpp"
+
+using task::Matrix;
+using task::Summation;
+
+const std::pair<Summation, const char*> kPolicies[] = {
+    {Summation::kNaive, "naive"},
+    {Summation::kPairwise, "pairwise"},
+    {Summation::kKahanBabuska, "kahan-babuska"},
+    {Summation::kVectorizedPairwise, "vectorized pairwise"},
+};
+
+// Values of both signs spread over many binary orders of magnitude, the
+// hard case for plain summation
+std::vector<double> RandomValues(size_t n) {
+  std::mt19937_64 rand(42);
+  std::uniform_real_distribution<double> mantissa{-1., 1.};
+  std::uniform_int_distribution<int> exponent{-20, 20};
+  std::vector<double> values(n);
+  for (double& value : values) {
+    value = std::ldexp(mantissa(rand), exponent(rand));
+  }
+  return values;
+}
+
+long double Exact(const std::vector<double>& values) {
+  long double result = 0., compensation = 0.;
+  for (double value : values) {
+    long double sum = result + value;
+    if (std::fabs(result) >= std::fabs(value)) {
+      compensation += (result - sum) + value;
+    } else {
+      compensation += (value - sum) + result;
+    }
+    result = sum;
+  }
+  return result + compensation;
+}
+
+void BenchmarkReduction(size_t n, int repeats) {
+  auto values = RandomValues(n);
+  long double exact = Exact(values);
+  const double* data = values.data();
+
+  std::cout << "sum of " << n << " values:\n";
+  for (auto [policy, name] : kPolicies) {
+    double result = 0.;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i) {
+      result = task::summation::Sum(policy, n,
+                                    [data](size_t k) { return data[k]; });
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double error = std::fabs((result - exact) / exact);
+    std::cout << "  " << std::setw(20) << std::left << name << std::right
+              << std::fixed << std::setprecision(3) << std::setw(8)
+              << elapsed.count() / repeats / n << " ns/value"
+              << std::scientific << std::setprecision(2)
+              << "  relative error " << error << "\n";
+  }
+}
+
+void BenchmarkProduct(size_t n) {
+  std::mt19937_64 rand(7);
+  std::uniform_real_distribution<double> dist{-10., 10.};
+  Matrix a(n, n), b(n, n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      a[i][j] = dist(rand);
+      b[i][j] = dist(rand);
+    }
+  }
+
+  std::cout << "product of " << n << " x " << n << " matrices:\n";
+  for (auto [policy, name] : kPolicies) {
+    task::SetSummation(policy);
+    auto start = std::chrono::steady_clock::now();
+    Matrix c = a * b;
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "  " << std::setw(20) << std::left << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8)
+              << elapsed.count() << " ms\n";
+  }
+  task::SetSummation(Summation::kNaive);
+}
+
+int main() {
+  BenchmarkReduction(1000, 10000);
+  BenchmarkReduction(1000000, 20);
+  BenchmarkProduct(512);
+  return 0;
+}
@@ -4,10 +4,11 @@ set -e
 
 STRESS_TEST_COUNT=500
 
-g++ -std=c++17 -I./ test/test.cpp src/matrix.cpp -o matrix_test
-python3 test/generate.py $STRESS_TEST_COUNT > test_data
+g++ -std=c++17 -pthread -I./ test/test.cpp -o matrix_test
+g++ -std=c++17 -O2 -pthread test/generate.cpp -o matrix_generate
+./matrix_generate $STRESS_TEST_COUNT > test_data
 ./matrix_test $STRESS_TEST_COUNT < test_data
 
-rm test_data
+rm test_data matrix_generate
 
 echo All tests passed!
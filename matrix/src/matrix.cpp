@@ -2,13 +2,66 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <memory>
+
+#include "thread_pool.h"
 
 namespace task {
 using namespace std;
 
+namespace {
+
+// Operations on fewer elements are not worth waking the workers up
+const size_t kParallelThreshold = 1 << 16;
+
+// Loaded and replaced atomically, so SetThreadCount may be called while
+// other threads compute; they finish on the pool they have loaded
+shared_ptr<ThreadPool> pool;
+
+Summation summation_policy = Summation::kNaive;
+
+// Calls band(begin, end) for consecutive ranges of rows. The same range
+// always goes to the same worker, so the first touch done by the
+// constructors decides on which NUMA node the kernels find the rows.
+template <class Band>
+void ForEachRowBand(size_t rows, size_t cols, Band band) {
+  shared_ptr<ThreadPool> workers;
+  if (rows * cols >= kParallelThreshold) {
+    workers = atomic_load(&pool);
+  }
+  if (!workers) {
+    band(0, rows);
+    return;
+  }
+  size_t bands = workers->size();
+  workers->Run([&](size_t index) {
+    band(rows * index / bands, rows * (index + 1) / bands);
+  });
+}
+
+}  // namespace
+
+void SetThreadCount(size_t count, bool pin) {
+  shared_ptr<ThreadPool> created;
+  if (count > 1) {
+    created = make_shared<ThreadPool>(count, pin);
+  }
+  // the old pool goes with the last operation still running on it
+  atomic_store(&pool, std::move(created));
+}
+
+size_t GetThreadCount() {
+  shared_ptr<ThreadPool> workers = atomic_load(&pool);
+  return workers ? workers->size() : 1;
+}
+
+void SetSummation(Summation policy) { summation_policy = policy; }
+
+Summation GetSummation() { return summation_policy; }
+
 Matrix::Matrix() {
-  rows_ = 1;
-  cols_ = 1;
+  rows_ = row_capacity_ = 1;
+  cols_ = col_capacity_ = 1;
 
   data_ = new MatrixRow[1];
 
@@ -17,17 +70,18 @@ Matrix::Matrix() {
 }
 
 Matrix::Matrix(size_t rows, size_t cols) {
-  rows_ = rows;
-  cols_ = cols;
+  rows_ = row_capacity_ = rows;
+  cols_ = col_capacity_ = cols;
 
   data_ = new MatrixRow[rows_];
-  for (size_t i = 0; i < rows_; ++i) {
-    data_[i].FillWithZeros(cols_);
-  }
-
-  for (size_t k = 0; k < min(rows, cols); ++k) {
-    data_[k][k] = 1.0;
-  }
+  ForEachRowBand(rows_, cols_, [this](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      data_[i].FillWithZeros(cols_);
+      if (i < cols_) {
+        data_[i][i] = 1.0;
+      }
+    }
+  });
 }
 
 Matrix::Matrix(const Matrix& other) { Assign(other); }
@@ -44,22 +98,46 @@ Matrix& Matrix::operator=(const Matrix& other) {
 Matrix::~Matrix() { Clear(); }
 
 void Matrix::Assign(const Matrix& other) {
-  rows_ = other.rows_;
-  cols_ = other.cols_;
+  rows_ = row_capacity_ = other.rows_;
+  cols_ = col_capacity_ = other.cols_;
 
   data_ = new MatrixRow[rows_];
-  for (size_t i = 0; i < rows_; ++i) {
-    data_[i].FillWithData(cols_, other.data_[i].data_);
-  }
+  ForEachRowBand(rows_, cols_, [this, &other](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      data_[i].FillWithData(cols_, other.data_[i].data_);
+    }
+  });
 }
 
 void Matrix::Clear() {
-  for (size_t i = 0; i < rows_; ++i) {
+  for (size_t i = 0; i < row_capacity_; ++i) {
     data_[i].Clear();
   }
   delete[] data_;
 }
 
+void Matrix::Reallocate(size_t row_capacity, size_t col_capacity) {
+  auto tmp = new MatrixRow[row_capacity];
+  for (size_t i = 0; i < min(row_capacity_, row_capacity); ++i) {
+    swap(tmp[i], data_[i]);
+  }
+  Clear();
+  data_ = tmp;
+  row_capacity_ = row_capacity;
+
+  if (col_capacity != col_capacity_) {
+    size_t keep = min(cols_, col_capacity);
+    for (size_t i = 0; i < row_capacity_; ++i) {
+      if (i < rows_) {
+        data_[i].Reallocate(col_capacity, keep);
+      } else {
+        data_[i].Clear();
+      }
+    }
+    col_capacity_ = col_capacity;
+  }
+}
+
 double& Matrix::get(size_t row, size_t col) {
   if (row >= rows_ || col >= cols_) {
     throw OutOfBoundsException();
@@ -86,26 +164,40 @@ void Matrix::resize(size_t new_rows, size_t new_cols) {
     return;
   }
 
-  auto tmp = new MatrixRow[new_rows];
-  for (size_t i = 0; i < new_rows; ++i) {
-    tmp[i].FillWithZeros(new_cols);
+  if (new_rows > row_capacity_ || new_cols > col_capacity_) {
+    Reallocate(new_rows > row_capacity_ ? max(new_rows, 2 * row_capacity_)
+                                        : row_capacity_,
+               new_cols > col_capacity_ ? max(new_cols, 2 * col_capacity_)
+                                        : col_capacity_);
   }
 
-  size_t rows_min = min(rows_, new_rows);
-  size_t cols_min = min(rows_, new_cols);
-  for (size_t i = 0; i < rows_min; ++i) {
-    for (size_t j = 0; j < cols_min; ++j) {
-      tmp[i][j] = data_[i][j];
+  for (size_t i = 0; i < min(rows_, new_rows); ++i) {
+    data_[i].Zero(cols_, new_cols);
+  }
+  for (size_t i = rows_; i < new_rows; ++i) {
+    if (data_[i].data_ == nullptr) {
+      data_[i].FillWithZeros(col_capacity_);
+    } else {
+      data_[i].Zero(0, new_cols);
     }
   }
 
-  Clear();
-  data_ = tmp;
-
   rows_ = new_rows;
   cols_ = new_cols;
 }
 
+void Matrix::reserve(size_t rows, size_t cols) {
+  if (rows > row_capacity_ || cols > col_capacity_) {
+    Reallocate(max(rows, row_capacity_), max(cols, col_capacity_));
+  }
+}
+
+void Matrix::shrink_to_fit() {
+  if (rows_ < row_capacity_ || cols_ < col_capacity_) {
+    Reallocate(rows_, cols_);
+  }
+}
+
 Matrix::MatrixRow& Matrix::operator[](size_t row) {
   if (row >= rows_) {
     throw OutOfBoundsException();
@@ -124,14 +216,16 @@ Matrix& Matrix::operator+=(const Matrix& other) {
   if (rows_ != other.rows_ || cols_ != other.cols_) {
     throw SizeMismatchException();
   }
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t j = 0; j < cols_; ++j) {
-      data_[i][j] += other.data_[i][j];
-      if (fabs(data_[i][j]) < EPS) {
-        data_[i][j] = 0;
+  ForEachRowBand(rows_, cols_, [this, &other](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      for (size_t j = 0; j < cols_; ++j) {
+        data_[i][j] += other.data_[i][j];
+        if (fabs(data_[i][j]) < EPS) {
+          data_[i][j] = 0;
+        }
       }
     }
-  }
+  });
   return *this;
 }
 
@@ -139,14 +233,16 @@ Matrix& Matrix::operator-=(const Matrix& other) {
   if (rows_ != other.rows_ || cols_ != other.cols_) {
     throw SizeMismatchException();
   }
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t j = 0; j < cols_; ++j) {
-      data_[i][j] -= other.data_[i][j];
-      if (fabs(data_[i][j]) < EPS) {
-        data_[i][j] = 0;
+  ForEachRowBand(rows_, cols_, [this, &other](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      for (size_t j = 0; j < cols_; ++j) {
+        data_[i][j] -= other.data_[i][j];
+        if (fabs(data_[i][j]) < EPS) {
+          data_[i][j] = 0;
+        }
       }
     }
-  }
+  });
   return *this;
 }
 
@@ -155,40 +251,59 @@ Matrix& Matrix::operator*=(const Matrix& other) {
     throw SizeMismatchException();
   }
 
-  auto tmp = new MatrixRow[rows_];
-  for (size_t i = 0; i < rows_; ++i) {
-    tmp[i].FillWithZeros(other.cols_);
+  // the vectorized policy loads whole lanes of a column, so it gets the
+  // columns of other as contiguous rows; the others read them in place
+  const Summation policy = summation_policy;
+  unique_ptr<Matrix> columns;
+  if (policy == Summation::kVectorizedPairwise) {
+    columns.reset(new Matrix(other.transposed()));
   }
 
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t j = 0; j < other.cols_; ++j) {
-      double& tk = tmp[i][j];
-      for (size_t k = 0; k < cols_; ++k) {
-        tk += data_[i][k] * other.data_[k][j];
-      }
-      if (fabs(tmp[i][j]) < EPS) {
-        tmp[i][j] = 0;
+  auto tmp = new MatrixRow[rows_];
+  ForEachRowBand(rows_, cols_ * other.cols_, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      tmp[i].FillWithZeros(other.cols_);
+      const double* row = data_[i].data_;
+      for (size_t j = 0; j < other.cols_; ++j) {
+        if (columns) {
+          const double* column = columns->data_[j].data_;
+          tmp[i][j] = summation::Sum(policy, cols_, [=](size_t k) {
+            return row[k] * column[k];
+          });
+        } else {
+          const MatrixRow* rows = other.data_;
+          tmp[i][j] = summation::Sum(policy, cols_, [=](size_t k) {
+            return row[k] * rows[k].data_[j];
+          });
+        }
+        if (fabs(tmp[i][j]) < EPS) {
+          tmp[i][j] = 0;
+        }
       }
     }
-  }
+  });
 
   Clear();
   data_ = tmp;
 
   cols_ = other.cols_;
+  row_capacity_ = rows_;
+  col_capacity_ = cols_;
 
   return *this;
 }
 
 Matrix& Matrix::operator*=(const double& number) {
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t j = 0; j < cols_; ++j) {
-      data_[i][j] *= number;
-      if (fabs(data_[i][j]) < EPS) {
-        data_[i][j] = 0;
+  ForEachRowBand(rows_, cols_, [this, &number](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      for (size_t j = 0; j < cols_; ++j) {
+        data_[i][j] *= number;
+        if (fabs(data_[i][j]) < EPS) {
+          data_[i][j] = 0;
+        }
       }
     }
-  }
+  });
   return *this;
 }
 
@@ -246,11 +361,8 @@ double Matrix::det() const {
       break;
     }
 
-    for (size_t j = 0; j < rows_; ++j) {
-      swap(tmp[k], tmp[i]);
-    }
-
     if (i != k) {
+      swap(tmp[k], tmp[i]);
       result = -result;
     }
 
@@ -275,8 +387,6 @@ double Matrix::det() const {
     }
   }
 
-  return result;
-
   for (size_t i = 0; i < rows_; ++i) {
     tmp[i].Clear();
   }
@@ -287,20 +397,21 @@ double Matrix::det() const {
 
 void Matrix::transpose() {
   auto tmp = new MatrixRow[cols_];
-  for (size_t i = 0; i < cols_; ++i) {
-    tmp[i].FillWithZeros(rows_);
-  }
-
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t j = 0; j < cols_; ++j) {
-      tmp[j][i] = data_[i][j];
+  ForEachRowBand(cols_, rows_, [&](size_t begin, size_t end) {
+    for (size_t j = begin; j < end; ++j) {
+      tmp[j].FillWithZeros(rows_);
+      for (size_t i = 0; i < rows_; ++i) {
+        tmp[j][i] = data_[i][j];
+      }
     }
-  }
+  });
 
   Clear();
   data_ = tmp;
 
   swap(rows_, cols_);
+  row_capacity_ = rows_;
+  col_capacity_ = cols_;
 }
 
 Matrix Matrix::transposed() const {
@@ -314,11 +425,8 @@ double Matrix::trace() const {
     throw SizeMismatchException();
   }
 
-  double result = 0.0;
-  for (size_t k = 0; k < rows_; ++k) {
-    result += data_[k][k];
-  }
-  return result;
+  return summation::Sum(summation_policy, rows_,
+                        [this](size_t k) { return data_[k][k]; });
 }
 
 vector<double> Matrix::getRow(size_t row) {
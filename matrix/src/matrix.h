@@ -3,6 +3,8 @@
 #include <vector>
 #include <iostream>
 
+#include "summation.h"
+
 namespace task {
 using namespace std;
 
@@ -11,18 +13,31 @@ const double EPS = 1e-6;
 class OutOfBoundsException : public exception {};
 class SizeMismatchException : public exception {};
 
+// Sets the number of worker threads used by operations on large matrices.
+// Each worker owns a fixed band of rows and is the first to touch them, so
+// on NUMA hosts the rows are placed on the node of the worker processing
+// them. If pin is set, workers are pinned to distinct cores. It may be
+// called while other threads compute, they finish on the old workers.
+void SetThreadCount(size_t count, bool pin = true);
+size_t GetThreadCount();
+
+// Sets how trace and matrix product accumulate their sums
+void SetSummation(Summation policy);
+Summation GetSummation();
+
 class Matrix {
   class MatrixRow {
     friend class Matrix;
 
    private:
-    size_t size_;
+    // number of values the row buffer can hold
+    size_t capacity_;
     double* data_;
 
     void FillWithZeros(size_t size) {
-      size_ = size;
-      data_ = new double[size_];
-      for (size_t i = 0; i < size_; ++i) {
+      capacity_ = size;
+      data_ = new double[capacity_];
+      for (size_t i = 0; i < capacity_; ++i) {
         data_[i] = 0.0;
       }
     }
@@ -31,22 +46,40 @@ class Matrix {
       if (data_ != nullptr) {
         delete[] data_;
       }
-      size_ = size;
-      data_ = new double[size_];
-      for (size_t i = 0; i < size_; ++i) {
+      capacity_ = size;
+      data_ = new double[capacity_];
+      for (size_t i = 0; i < capacity_; ++i) {
         data_[i] = data[i];
       }
     }
 
+    // moves the first size values to a buffer of the given capacity
+    void Reallocate(size_t capacity, size_t size) {
+      auto tmp = new double[capacity];
+      for (size_t i = 0; i < size; ++i) {
+        tmp[i] = data_[i];
+      }
+      Clear();
+      capacity_ = capacity;
+      data_ = tmp;
+    }
+
+    void Zero(size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        data_[i] = 0.0;
+      }
+    }
+
     void Clear() {
       if (data_ != nullptr) {
         delete[] data_;
       }
+      capacity_ = 0;
       data_ = nullptr;
     }
 
    public:
-    MatrixRow() : size_(0), data_(nullptr) {}
+    MatrixRow() : capacity_(0), data_(nullptr) {}
 
     ~MatrixRow() {}
 
@@ -57,8 +90,13 @@ class Matrix {
 
   size_t rows_ = 0;
   size_t cols_ = 0;
+  // rows past rows_ keep their buffers (if any) for reuse by resize
+  size_t row_capacity_ = 0;
+  // every row buffer holds col_capacity_ values
+  size_t col_capacity_ = 0;
   MatrixRow* data_ = nullptr;
 
+  void Reallocate(size_t row_capacity, size_t col_capacity);
   void Assign(const Matrix& other);
   void Clear();
 
@@ -77,6 +115,13 @@ class Matrix {
   void set(size_t row, size_t col, const double& value);
   void resize(size_t new_rows, size_t new_cols);
 
+  // Like std::vector, storage is only reallocated when a resize goes beyond
+  // the capacity, which then grows geometrically.
+  constexpr size_t row_capacity() const { return row_capacity_; }
+  constexpr size_t col_capacity() const { return col_capacity_; }
+  void reserve(size_t rows, size_t cols);
+  void shrink_to_fit();
+
   MatrixRow& operator[](size_t row);
   MatrixRow& operator[](size_t row) const;
 
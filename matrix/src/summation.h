@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace task {
+
+// Accumulation policy used by trace and the dot products of matrix product
+enum class Summation {
+  // sequential sum, error grows linearly with the length
+  kNaive,
+  // recursive halving, error grows logarithmically
+  kPairwise,
+  // Neumaier's compensated sum, error does not depend on the length
+  kKahanBabuska,
+  // pairwise over blocks summed with independent accumulators, which
+  // the compiler keeps in vector registers
+  kVectorizedPairwise,
+};
+
+namespace summation {
+
+// Every function sums term(0) + ... + term(n - 1)
+
+const size_t kPairwiseBlock = 8;
+const size_t kVectorBlock = 128;
+const size_t kVectorLanes = 8;
+
+template <class Term>
+double Naive(size_t begin, size_t end, const Term& term) {
+  double result = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    result += term(i);
+  }
+  return result;
+}
+
+template <class Term>
+double Pairwise(size_t begin, size_t end, const Term& term) {
+  if (end - begin <= kPairwiseBlock) {
+    return Naive(begin, end, term);
+  }
+  size_t middle = begin + (end - begin) / 2;
+  return Pairwise(begin, middle, term) + Pairwise(middle, end, term);
+}
+
+template <class Term>
+double KahanBabuska(size_t begin, size_t end, const Term& term) {
+  double result = 0.0;
+  double compensation = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    double value = term(i);
+    double sum = result + value;
+    if (std::fabs(result) >= std::fabs(value)) {
+      compensation += (result - sum) + value;
+    } else {
+      compensation += (value - sum) + result;
+    }
+    result = sum;
+  }
+  return result + compensation;
+}
+
+template <class Term>
+double VectorizedPairwise(size_t begin, size_t end, const Term& term) {
+  if (end - begin > kVectorBlock) {
+    size_t middle = begin + (end - begin) / 2 / kVectorLanes * kVectorLanes;
+    return VectorizedPairwise(begin, middle, term) +
+           VectorizedPairwise(middle, end, term);
+  }
+
+  double lanes[kVectorLanes] = {};
+  size_t i = begin;
+  for (; i + kVectorLanes <= end; i += kVectorLanes) {
+    for (size_t lane = 0; lane < kVectorLanes; ++lane) {
+      lanes[lane] += term(i + lane);
+    }
+  }
+  for (size_t width = kVectorLanes / 2; width > 0; width /= 2) {
+    for (size_t lane = 0; lane < width; ++lane) {
+      lanes[lane] += lanes[lane + width];
+    }
+  }
+  return lanes[0] + Naive(i, end, term);
+}
+
+template <class Term>
+double Sum(Summation policy, size_t n, const Term& term) {
+  switch (policy) {
+    case Summation::kPairwise:
+      return Pairwise(0, n, term);
+    case Summation::kKahanBabuska:
+      return KahanBabuska(0, n, term);
+    case Summation::kVectorizedPairwise:
+      return VectorizedPairwise(0, n, term);
+    default:
+      return Naive(0, n, term);
+  }
+}
+
+}  // namespace summation
+
+}  // namespace task
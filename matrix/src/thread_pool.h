@@ -0,0 +1,146 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace task {
+
+// Fixed-size pool of worker threads used by the row-parallel matrix kernels.
+//
+// Work is always split into size() static bands and band i is always
+// executed by worker i. Combined with pinning, this keeps every row of a
+// matrix on the core (and so the NUMA node) that touched it first.
+// Run() may be called from several threads, the calls take turns.
+class ThreadPool {
+ public:
+  ThreadPool(size_t threads, bool pin) {
+    std::vector<int> cpus = AvailableCpus();
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.emplace_back(&ThreadPool::Work, this, i);
+      if (pin && !cpus.empty()) {
+        Pin(workers_.back(), cpus[i % cpus.size()]);
+      }
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  // Runs band(i) on worker i for every i in [0, size()) and waits for all.
+  // The first exception thrown by a band is rethrown here once every band
+  // has finished.
+  void Run(const std::function<void(size_t)>& band) {
+    // done_.wait releases mutex_, so another call must not start before
+    // this one is over
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    band_ = &band;
+    pending_ = workers_.size();
+    ++generation_;
+    wake_.notify_all();
+    done_.wait(lock, [this] { return pending_ == 0; });
+    band_ = nullptr;
+    if (error_) {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+
+  const std::function<void(size_t)>* band_ = nullptr;
+  size_t generation_ = 0;
+  size_t pending_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+
+  void Work(size_t index) {
+    size_t seen = 0;
+    for (;;) {
+      const std::function<void(size_t)>* band;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        band = band_;
+      }
+
+      std::exception_ptr error;
+      try {
+        (*band)(index);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error && !error_) {
+        error_ = error;
+      }
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  static std::vector<int> AvailableCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+#endif
+    return cpus;
+  }
+
+  static void Pin(std::thread& thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+  }
+};
+
+}  // namespace task
@@ -0,0 +1,307 @@
+// Native counterpart of generate.py: prints the same sequence of test cases
+// (operands followed by the expected results), but generates them on all
+// cores and can write them in a binary form for large load tests.
+//
+// Usage: generate <count> [--seed S] [--threads T] [--format text|binary]
+//                         [--max-size N] [--max-det-size N]
+//
+// Every test case draws from its own random stream derived from the seed,
+// so the output does not depend on the number of threads.
+//
+// The binary format stores a matrix as two uint64 values (rows, cols)
+// followed by rows * cols doubles, and a scalar as a single double, all in
+// the host byte order.
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  size_t count = 0;
+  uint64_t seed = std::random_device{}();
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  bool binary = false;
+  size_t max_size = 10;
+  size_t max_det_size = 6;
+};
+
+struct Dense {
+  size_t rows;
+  size_t cols;
+  std::vector<double> values;
+
+  Dense(size_t rows, size_t cols)
+      : rows(rows), cols(cols), values(rows * cols) {}
+
+  double& at(size_t row, size_t col) { return values[row * cols + col]; }
+  double at(size_t row, size_t col) const { return values[row * cols + col]; }
+};
+
+uint64_t SplitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+class Writer {
+ public:
+  explicit Writer(bool binary) : binary_(binary) {}
+
+  const std::string& str() const { return out_; }
+
+  void Scalar(double value) {
+    if (binary_) {
+      Raw(value);
+    } else {
+      Number(value);
+      out_ += '\n';
+    }
+  }
+
+  void Matrix(const Dense& mat) {
+    if (binary_) {
+      Raw(static_cast<uint64_t>(mat.rows));
+      Raw(static_cast<uint64_t>(mat.cols));
+      out_.append(reinterpret_cast<const char*>(mat.values.data()),
+                  mat.values.size() * sizeof(double));
+      return;
+    }
+    out_ += std::to_string(mat.rows);
+    out_ += ' ';
+    out_ += std::to_string(mat.cols);
+    out_ += '\n';
+    for (size_t i = 0; i < mat.rows; ++i) {
+      for (size_t j = 0; j < mat.cols; ++j) {
+        if (j != 0) {
+          out_ += ' ';
+        }
+        Number(mat.at(i, j));
+      }
+      out_ += '\n';
+    }
+  }
+
+ private:
+  bool binary_;
+  std::string out_;
+
+  template <class V>
+  void Raw(V value) {
+    out_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void Number(double value) {
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out_.append(buf, result.ptr);
+  }
+};
+
+class Generator {
+ public:
+  Generator(const Options& options, size_t index)
+      : options_(options), rand_(SplitMix64(options.seed ^ SplitMix64(index))) {}
+
+  // Mirrors gen_tests() of generate.py
+  std::string Case() {
+    Writer out(options_.binary);
+
+    size_t n = Size(options_.max_size);
+    size_t m = Size(options_.max_size);
+    Dense mat1 = Random(n, m);
+    Dense mat2 = Random(n, m);
+    Dense mat3 = Random(m, Size(options_.max_size));
+    double scalar = Value();
+    Dense mat_sq = Random(n, n);
+    size_t small = Size(options_.max_det_size);
+    Dense mat_sq_sm = Random(small, small);
+
+    out.Matrix(mat1);
+    out.Matrix(mat2);
+    out.Matrix(Combine(mat1, mat2, 1.));
+    out.Matrix(Combine(mat1, mat2, -1.));
+    out.Matrix(mat3);
+    out.Matrix(Multiply(mat1, mat3));
+    out.Scalar(scalar);
+    out.Matrix(Scale(mat1, scalar));
+    out.Matrix(Scale(mat1, -1.));
+    out.Matrix(Transpose(mat1));
+    out.Matrix(mat_sq);
+    out.Scalar(Trace(mat_sq));
+    out.Matrix(mat_sq_sm);
+    out.Scalar(Det(mat_sq_sm));
+
+    return out.str();
+  }
+
+ private:
+  const Options& options_;
+  std::mt19937_64 rand_;
+
+  size_t Size(size_t max) {
+    return std::uniform_int_distribution<size_t>{1, max - 1}(rand_);
+  }
+
+  double Value() {
+    return std::uniform_real_distribution<double>{-10., 10.}(rand_);
+  }
+
+  Dense Random(size_t rows, size_t cols) {
+    Dense result(rows, cols);
+    for (double& value : result.values) {
+      value = Value();
+    }
+    return result;
+  }
+
+  static Dense Combine(const Dense& a, const Dense& b, double sign) {
+    Dense result(a.rows, a.cols);
+    for (size_t i = 0; i < a.values.size(); ++i) {
+      result.values[i] = a.values[i] + sign * b.values[i];
+    }
+    return result;
+  }
+
+  static Dense Scale(const Dense& a, double scalar) {
+    Dense result(a.rows, a.cols);
+    for (size_t i = 0; i < a.values.size(); ++i) {
+      result.values[i] = scalar * a.values[i];
+    }
+    return result;
+  }
+
+  static Dense Multiply(const Dense& a, const Dense& b) {
+    Dense result(a.rows, b.cols);
+    for (size_t i = 0; i < a.rows; ++i) {
+      for (size_t k = 0; k < a.cols; ++k) {
+        for (size_t j = 0; j < b.cols; ++j) {
+          result.at(i, j) += a.at(i, k) * b.at(k, j);
+        }
+      }
+    }
+    return result;
+  }
+
+  static Dense Transpose(const Dense& a) {
+    Dense result(a.cols, a.rows);
+    for (size_t i = 0; i < a.rows; ++i) {
+      for (size_t j = 0; j < a.cols; ++j) {
+        result.at(j, i) = a.at(i, j);
+      }
+    }
+    return result;
+  }
+
+  static double Trace(const Dense& a) {
+    double result = 0.;
+    for (size_t k = 0; k < a.rows; ++k) {
+      result += a.at(k, k);
+    }
+    return result;
+  }
+
+  // LU decomposition with partial pivoting in extended precision
+  static double Det(const Dense& a) {
+    size_t n = a.rows;
+    std::vector<long double> lu(a.values.begin(), a.values.end());
+    long double result = 1.;
+    for (size_t i = 0; i < n; ++i) {
+      size_t pivot = i;
+      for (size_t j = i + 1; j < n; ++j) {
+        if (std::fabs(lu[j * n + i]) > std::fabs(lu[pivot * n + i])) {
+          pivot = j;
+        }
+      }
+      if (lu[pivot * n + i] == 0.) {
+        return 0.;
+      }
+      if (pivot != i) {
+        std::swap_ranges(lu.begin() + i * n, lu.begin() + (i + 1) * n,
+                         lu.begin() + pivot * n);
+        result = -result;
+      }
+      result *= lu[i * n + i];
+      for (size_t j = i + 1; j < n; ++j) {
+        long double factor = lu[j * n + i] / lu[i * n + i];
+        for (size_t k = i + 1; k < n; ++k) {
+          lu[j * n + k] -= factor * lu[i * n + k];
+        }
+      }
+    }
+    return static_cast<double>(result);
+  }
+};
+
+Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << arg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      return argv[++i];
+    };
+    if (arg == "--seed") {
+      options.seed = std::stoull(value());
+    } else if (arg == "--threads") {
+      options.threads = std::max<size_t>(1, std::stoul(value()));
+    } else if (arg == "--format") {
+      options.binary = (value() == "binary");
+    } else if (arg == "--max-size") {
+      options.max_size = std::max<size_t>(2, std::stoul(value()));
+    } else if (arg == "--max-det-size") {
+      options.max_det_size = std::max<size_t>(2, std::stoul(value()));
+    } else {
+      options.count = std::stoul(arg);
+    }
+  }
+  return options;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::ios::sync_with_stdio(false);
+  const Options options = ParseOptions(argc, argv);
+
+  // Keep roughly a million values per thread in flight between writes
+  const size_t per_thread = std::max<size_t>(
+      1, (1 << 20) / (options.max_size * options.max_size));
+  const size_t batch = per_thread * options.threads;
+
+  std::vector<std::string> cases(batch);
+  for (size_t start = 0; start < options.count; start += batch) {
+    size_t end = std::min(options.count, start + batch);
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < options.threads; ++t) {
+      workers.emplace_back([&, t] {
+        for (size_t i = start + t; i < end; i += options.threads) {
+          cases[i - start] = Generator(options, i).Case();
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    for (size_t i = start; i < end; ++i) {
+      std::cout.write(cases[i - start].data(), cases[i - start].size());
+    }
+  }
+
+  return 0;
+}
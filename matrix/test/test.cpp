@@ -3,7 +3,9 @@
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
 #include "../src/matrix.cpp"
 
@@ -122,14 +124,42 @@ int main(int argc, char** argv) {
                         mat[1][1] == 0.,
                     "resize()")
 
-    /*
     REPEAT(1000) {
-        // oh boy i sure can't wait to resize
-        mat.resize(1000, 1000);
-        mat.resize(500, 500);
-        // what do you mean memory leaks?
+      // oh boy i sure can't wait to resize
+      mat.resize(1000, 1000);
+      mat.resize(500, 500);
+      // what do you mean memory leaks?
     }
-    */
+
+    auto mat4 = RandomMatrix(3, 5);
+    const Matrix mat4_c = mat4;
+
+    mat4.resize(3, 7);
+    ASSERT_TRUE_MSG(mat4.getRow(2)[4] == mat4_c[2][4] && mat4[2][6] == 0.,
+                    "resize()")
+
+    mat4.resize(2, 2);
+    const double* mat4_data = &mat4[0][0];
+    mat4.resize(3, 6);
+    ASSERT_TRUE_MSG(&mat4[0][0] == mat4_data, "resize() within capacity")
+    ASSERT_TRUE_MSG(mat4[1][1] == mat4_c[1][1] && mat4[1][2] == 0. &&
+                        mat4[2][0] == 0. && mat4[2][5] == 0.,
+                    "resize() within capacity")
+
+    mat4.reserve(100, 100);
+    ASSERT_TRUE_MSG(mat4.row_capacity() == 100 && mat4.col_capacity() == 100,
+                    "reserve()")
+    ASSERT_TRUE_MSG(mat4[0][1] == mat4_c[0][1], "reserve()")
+    mat4_data = &mat4[0][0];
+    mat4.resize(100, 100);
+    ASSERT_TRUE_MSG(&mat4[0][0] == mat4_data && mat4[99][99] == 0.,
+                    "resize() within capacity")
+
+    mat4.resize(2, 2);
+    mat4.shrink_to_fit();
+    ASSERT_TRUE_MSG(mat4.row_capacity() == 2 && mat4.col_capacity() == 2,
+                    "shrink_to_fit()")
+    ASSERT_TRUE_MSG(mat4[1][0] == mat4_c[1][0], "shrink_to_fit()")
 
     auto mat3 = RandomMatrix(1000, 1000);
     for (size_t i = 0; i < 1000; ++i) {
@@ -213,6 +243,81 @@ int main(int argc, char** argv) {
     ASSERT_TRUE_MSG(mat1 == mat2, "Stream input / output operator")
   }
 
+  {
+    auto mat1 = RandomMatrix(300, 300);
+    auto mat2 = RandomMatrix(300, 300);
+    auto sum = mat1 + mat2;
+    auto product = mat1 * mat2;
+    auto transposed = mat1.transposed();
+
+    task::SetThreadCount(4);
+    ASSERT_TRUE_MSG(task::GetThreadCount() == 4, "SetThreadCount()")
+
+    Matrix identity(300, 300);
+    ASSERT_TRUE_MSG(identity[299][299] == 1. && identity[299][0] == 0.,
+                    "Parallel rows / cols constructor")
+    ASSERT_TRUE_MSG(Matrix(mat1) == mat1, "Parallel copy constructor")
+    ASSERT_TRUE_MSG(mat1 + mat2 == sum, "Parallel operator +")
+    ASSERT_TRUE_MSG(mat1 * mat2 == product, "Parallel operator *")
+    ASSERT_TRUE_MSG(mat1.transposed() == transposed, "Parallel transpose")
+
+    auto reversed = mat2 * mat1;
+    Matrix first, second;
+    std::thread other([&] { second = mat2 * mat1; });
+    first = mat1 * mat2;
+    other.join();
+    ASSERT_TRUE_MSG(first == product && second == reversed,
+                    "Products from two threads")
+
+    task::ThreadPool pool(4, false);
+    bool thrown = false;
+    try {
+      pool.Run([](size_t index) {
+        if (index == 2) {
+          throw std::runtime_error("band");
+        }
+      });
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    ASSERT_TRUE_MSG(thrown, "Exception from a band")
+
+    std::thread resizer([] {
+      for (size_t count : {2, 3, 1, 4}) {
+        task::SetThreadCount(count, false);
+      }
+    });
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE_MSG(mat1 * mat2 == product, "SetThreadCount() meanwhile")
+    }
+    resizer.join();
+
+    task::SetThreadCount(1);
+    ASSERT_TRUE_MSG(task::GetThreadCount() == 1, "SetThreadCount()")
+  }
+
+  {
+    Matrix mat(4, 4);
+    mat[0][0] = 1e16;
+    mat[1][1] = 1.;
+    mat[2][2] = -1e16;
+    mat[3][3] = 1.;
+
+    task::SetSummation(task::Summation::kKahanBabuska);
+    ASSERT_TRUE_MSG(mat.trace() == 2., "Compensated trace")
+
+    auto mat1 = RandomMatrix(70, 300);
+    auto mat2 = RandomMatrix(300, 50);
+    for (auto policy :
+         {task::Summation::kNaive, task::Summation::kPairwise,
+          task::Summation::kVectorizedPairwise}) {
+      auto product = mat1 * mat2;
+      task::SetSummation(policy);
+      ASSERT_TRUE_MSG(mat1 * mat2 == product, "Summation policies")
+    }
+    task::SetSummation(task::Summation::kNaive);
+  }
+
   const int STRESS_TEST_COUNT = argc > 1 ? std::stoi(argv[1]) : 0;
 
   REPEAT(STRESS_TEST_COUNT) {
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+set -e
+
+g++ -std=c++17 -O2 -pthread -I./ bench/moves.cpp -o smart_pointers_moves
+g++ -std=c++17 -O2 -pthread -I./ bench/readers.cpp -o smart_pointers_readers
+./smart_pointers_moves
+./smart_pointers_readers
+
+rm smart_pointers_moves smart_pointers_readers
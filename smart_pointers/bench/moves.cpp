@@ -0,0 +1,103 @@
+// Cost of moving shared pointers through std::vector reallocation. All
+// elements point to one object, so every refcount operation hits the same
+// counter; with true moves the reallocation does none. The "copies" rows
+// wrap the pointer in a type without a move constructor, which is what
+// every move cost before.
+//
+// Usage: smart_pointers_moves [elements per vector] [threads]
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/smart_pointers.h"
+
+namespace {
+
+template <class P>
+struct CopyOnly {
+  P ptr;
+  explicit CopyOnly(const P& ptr) : ptr(ptr) {}
+  CopyOnly(const CopyOnly& other) : ptr(other.ptr) {}
+};
+
+// ns per element moved by vector growth, in each of threads at once
+template <class Element, class P>
+double Measure(const P& shared, size_t elements, size_t threads) {
+  const int kRepeats = 10;
+  std::vector<double> results(threads);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      double best = 1e100;
+      for (int r = 0; r < kRepeats; ++r) {
+        std::vector<Element> vec(elements, Element(shared));
+        auto start = std::chrono::steady_clock::now();
+        vec.reserve(vec.capacity() * 2);
+        std::chrono::duration<double, std::nano> time =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, time.count() / elements);
+      }
+      results[t] = best;
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  double sum = 0;
+  for (double result : results) {
+    sum += result;
+  }
+  return sum / threads;
+}
+
+// the threaded columns are left out for pointers local to one thread
+template <class P>
+void Report(const char* name, const P& shared, size_t elements,
+            size_t threads, bool concurrent) {
+  std::cout << std::left << std::setw(24) << name << std::right
+            << std::fixed << std::setprecision(2);
+  std::cout << std::setw(10) << Measure<P>(shared, elements, 1);
+  if (concurrent) {
+    std::cout << std::setw(10) << Measure<P>(shared, elements, threads);
+  } else {
+    std::cout << std::setw(10) << "-";
+  }
+  std::cout << std::setw(10) << Measure<CopyOnly<P>>(shared, elements, 1);
+  if (concurrent) {
+    std::cout << std::setw(10)
+              << Measure<CopyOnly<P>>(shared, elements, threads);
+  } else {
+    std::cout << std::setw(10) << "-";
+  }
+  std::cout << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t elements = argc > 1 ? std::stoul(argv[1]) : 1'000'000;
+  size_t threads = argc > 2 ? std::stoul(argv[2])
+                            : std::max(2u, std::thread::hardware_concurrency());
+  std::string threaded = "x" + std::to_string(threads);
+
+  std::cout << "ns per element when a vector of " << elements
+            << " pointers to one object grows, in 1 and " << threads
+            << " threads at once\n";
+  std::cout << std::left << std::setw(24) << "pointer" << std::right
+            << std::setw(10) << "moves" << std::setw(10) << threaded
+            << std::setw(10) << "copies" << std::setw(10) << threaded << '\n';
+  Report("task::SharedPtr", task::MakeShared<int>(1), elements, threads,
+         true);
+  Report("task::LocalSharedPtr",
+         task::MakeShared<int, task::util::PlainCount>(1), elements, threads,
+         false);
+  Report("std::shared_ptr", std::make_shared<int>(1), elements, threads,
+         true);
+  return 0;
+}
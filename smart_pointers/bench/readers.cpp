@@ -0,0 +1,140 @@
+// Readers copying the current snapshot while one writer keeps publishing
+// new ones: AtomicSharedPtr against a SharedPtr behind a mutex and the
+// std::atomic_load functions for std::shared_ptr. Prints the total number
+// of snapshot loads per second for every reader count.
+//
+// Usage: smart_pointers_readers [max readers] [ms per run]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/smart_pointers.h"
+
+namespace {
+
+struct Config {
+  long version;
+  long payload[7] = {};
+};
+
+class AtomicSlot {
+ public:
+  static constexpr const char* kName = "AtomicSharedPtr";
+
+  long Read() const { return ptr_.load()->version; }
+  void Publish(long version) {
+    ptr_.store(task::MakeShared<Config>(Config{version}));
+  }
+
+ private:
+  task::AtomicSharedPtr<Config> ptr_{task::MakeShared<Config>(Config{0})};
+};
+
+class MutexSlot {
+ public:
+  static constexpr const char* kName = "SharedPtr + mutex";
+
+  long Read() const {
+    task::SharedPtr<Config> copy;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      copy = ptr_;
+    }
+    return copy->version;
+  }
+
+  void Publish(long version) {
+    auto fresh = task::MakeShared<Config>(Config{version});
+    std::lock_guard<std::mutex> guard(mutex_);
+    ptr_.swap(fresh);
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  task::SharedPtr<Config> ptr_ = task::MakeShared<Config>(Config{0});
+};
+
+class StdSlot {
+ public:
+  static constexpr const char* kName = "std::atomic_load";
+
+  long Read() const { return std::atomic_load(&ptr_)->version; }
+  void Publish(long version) {
+    std::atomic_store(&ptr_, std::make_shared<Config>(Config{version}));
+  }
+
+ private:
+  std::shared_ptr<Config> ptr_ = std::make_shared<Config>(Config{0});
+};
+
+// millions of loads per second over all readers
+template <class Slot>
+double Measure(size_t readers, std::chrono::milliseconds duration) {
+  Slot slot;
+  std::atomic<bool> done{false};
+  std::atomic<long> loads{0};
+  std::vector<std::thread> threads;
+  for (size_t r = 0; r < readers; ++r) {
+    threads.emplace_back([&] {
+      long count = 0;
+      long seen = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        seen = std::max(seen, slot.Read());
+        ++count;
+      }
+      loads += count;
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (long version = 1; std::chrono::steady_clock::now() - start < duration;
+       ++version) {
+    slot.Publish(version);
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+  return loads / seconds.count() / 1e6;
+}
+
+template <class Slot>
+void Report(size_t max_readers, std::chrono::milliseconds duration) {
+  std::cout << std::left << std::setw(20) << Slot::kName << std::right
+            << std::fixed << std::setprecision(1);
+  for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+    std::cout << std::setw(9) << Measure<Slot>(readers, duration);
+  }
+  std::cout << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t max_readers =
+      argc > 1 ? std::stoul(argv[1])
+               : std::max(1u, std::thread::hardware_concurrency());
+  std::chrono::milliseconds duration(argc > 2 ? std::stol(argv[2]) : 300);
+
+  std::cout << "Million snapshot loads per second, one writer publishing "
+               "every 100 us\n";
+  std::cout << std::left << std::setw(20) << "readers" << std::right;
+  for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+    std::cout << std::setw(9) << readers;
+  }
+  std::cout << '\n';
+  Report<AtomicSlot>(max_readers, duration);
+  Report<MutexSlot>(max_readers, duration);
+  Report<StdSlot>(max_readers, duration);
+  return 0;
+}
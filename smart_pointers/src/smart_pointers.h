@@ -1,79 +1,344 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <type_traits>
 #include <utility>
 
 namespace task {
 
+namespace util {
+class AtomicCount;
+class PlainCount;
+}  // namespace util
+
 // Forward deaclarations
 template <class T>
+struct DefaultDelete;
+template <class T, class D = DefaultDelete<T>>
 class UniquePtr;
-template <class T>
+template <class T, class Count = util::AtomicCount>
 class SharedPtr;
-template <class T>
+template <class T, class Count = util::AtomicCount>
 class WeakPtr;
+template <class T>
+class AtomicSharedPtr;
+template <class T>
+class IntrusivePtr;
 
-namespace util {
+// Pointers for objects that never leave one thread, their counts are
+// updated without atomic operations
 template <class T>
+using LocalSharedPtr = SharedPtr<T, util::PlainCount>;
+template <class T>
+using LocalWeakPtr = WeakPtr<T, util::PlainCount>;
+
+// Construct an object together with its counter in a single allocation
+// made by alloc; the object is destroyed with the last SharedPtr and the
+// storage is freed with the last WeakPtr. For T = E[] the arguments are
+// the number of elements and optionally the value to copy into each of
+// them, the elements follow the counter in the same allocation.
+template <class T, class Count = util::AtomicCount, class Alloc,
+          class... Args>
+SharedPtr<T, Count> AllocateShared(const Alloc& alloc, Args&&... args);
+
+// AllocateShared with std::allocator
+template <class T, class Count = util::AtomicCount, class... Args>
+SharedPtr<T, Count> MakeShared(Args&&... args);
+
+namespace util {
+// Reference count of owners that may live in different threads. A new
+// owner is always made from an existing one, so increments are relaxed;
+// decrements are acq_rel, so the owner that drops the count to zero sees
+// every write made through the others before destroying anything.
+class AtomicCount {
+ public:
+  explicit AtomicCount(long value) : value_(value) {}
+
+  long Load() const { return value_.load(std::memory_order_relaxed); }
+
+  void Increment() { value_.fetch_add(1, std::memory_order_relaxed); }
+
+  // add n references made while an existing one was held
+  void Add(long n) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+  // returns the new value
+  long Decrement() {
+    return value_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+  }
+
+  // returns false and leaves the count alone if it is zero
+  bool IncrementIfNotZero() {
+    long value = value_.load(std::memory_order_relaxed);
+    while (value != 0) {
+      if (value_.compare_exchange_weak(value, value + 1,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::atomic<long> value_;
+};
+
+// Reference count of owners that never leave one thread
+class PlainCount {
+ public:
+  explicit PlainCount(long value) : value_(value) {}
+
+  long Load() const { return value_; }
+
+  void Increment() { ++value_; }
+
+  long Decrement() { return --value_; }
+
+  bool IncrementIfNotZero() {
+    if (value_ == 0) {
+      return false;
+    }
+    ++value_;
+    return true;
+  }
+
+ private:
+  long value_;
+};
+
+// Selects the constructors that take over a reference held by the caller
+struct AdoptTag {};
+
+// T may be an array E[], then ptr points to its first element
+template <class T, class Count>
 struct RefCounter {
-  T* ptr;
-  long use_count;
-  long weak_count;
+  using element_type = std::remove_extent_t<T>;
+
+  element_type* ptr;
+  // number of SharedPtrs, the object is deleted when it drops to zero
+  Count use_count;
+  // number of WeakPtrs plus one for all SharedPtrs together, the counter
+  // is deleted when it drops to zero
+  Count weak_count;
+
+  explicit RefCounter(element_type* ptr)
+      : ptr(ptr), use_count(1), weak_count(1) {}
+  virtual ~RefCounter() = default;
 
-  static T* GetPtr(RefCounter* counter);
+  // destroy the object, called when the last SharedPtr is gone
+  virtual void Dispose() { DefaultDelete<T>()(ptr); }
+  // free the counter, called when the last WeakPtr is gone
+  virtual void Destroy() { delete this; }
+
+  static element_type* GetPtr(RefCounter* counter);
   static long UseCount(RefCounter* counter);
   static long WeakCount(RefCounter* counter);
 
-  static RefCounter* SharedCounter(T* ptr);
+  static RefCounter* SharedCounter(element_type* ptr);
 
   static RefCounter* IncrementShared(RefCounter* counter);
   static RefCounter* DecrementShared(RefCounter* counter);
+  // returns nullptr instead of a new shared reference to a deleted object
+  static RefCounter* LockShared(RefCounter* counter);
 
   static RefCounter* IncrementWeak(RefCounter* counter);
   static RefCounter* DecrementWeak(RefCounter* counter);
 };
+
+// Holds a value of a possibly empty class, taking no room for it when the
+// class is empty and may be derived from
+template <class V, bool = std::is_empty_v<V> && !std::is_final_v<V>>
+class Compressed {
+ public:
+  explicit Compressed(const V& value) : value_(value) {}
+  explicit Compressed(V&& value) : value_(std::move(value)) {}
+  V& Get() { return value_; }
+  const V& Get() const { return value_; }
+
+ private:
+  V value_;
+};
+
+template <class V>
+class Compressed<V, true> : private V {
+ public:
+  explicit Compressed(const V& value) : V(value) {}
+  explicit Compressed(V&& value) : V(std::move(value)) {}
+  V& Get() { return *this; }
+  const V& Get() const { return *this; }
+};
+
+// Counter with the object right after it, made by AllocateShared
+template <class T, class Count, class Alloc>
+class InplaceRefCounter : public RefCounter<T, Count>,
+                          private Compressed<Alloc> {
+  using Allocator = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<InplaceRefCounter>;
+  using Traits = std::allocator_traits<Allocator>;
+
+ public:
+  template <class... Args>
+  static InplaceRefCounter* Create(const Alloc& alloc, Args&&... args);
+
+  void Dispose() override { this->ptr->~T(); }
+  void Destroy() override;
+
+ private:
+  explicit InplaceRefCounter(const Alloc& alloc)
+      : RefCounter<T, Count>(nullptr), Compressed<Alloc>(alloc) {}
+
+  alignas(T) unsigned char storage_[sizeof(T)];
+};
+
+// Counter with an array of size elements right after it, made by
+// AllocateShared<E[]>. The counter is aligned for E, so the elements
+// start at this + 1 and the block is allocated in units of the counter.
+template <class E, class Count, class Alloc>
+class alignas(std::max(alignof(E), alignof(RefCounter<E[], Count>)))
+    InplaceArrayRefCounter
+    : public RefCounter<E[], Count>,
+      private Compressed<Alloc> {
+  using Allocator = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<InplaceArrayRefCounter>;
+  using Traits = std::allocator_traits<Allocator>;
+
+ public:
+  // every element is made as E(args...), value-initialized if there are
+  // no args
+  template <class... Args>
+  static InplaceArrayRefCounter* Create(const Alloc& alloc, std::size_t size,
+                                        const Args&... args);
+
+  void Dispose() override;
+  void Destroy() override;
+
+ private:
+  InplaceArrayRefCounter(const Alloc& alloc, std::size_t size)
+      : RefCounter<E[], Count>(nullptr),
+        Compressed<Alloc>(alloc),
+        size_(size) {}
+
+  // number of counter sized units holding the counter and size elements
+  static std::size_t Units(std::size_t size);
+
+  // destroy the first count elements in reverse order
+  void DestroyElements(std::size_t count);
+
+  std::size_t size_;
+};
+
+// Counter of an object released by a deleter, allocated by alloc
+template <class T, class Count, class D, class Alloc>
+class DeleterRefCounter : public RefCounter<T, Count>,
+                          private Compressed<D>,
+                          private Compressed<Alloc> {
+  using Allocator = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<DeleterRefCounter>;
+  using Traits = std::allocator_traits<Allocator>;
+
+ public:
+  using element_type = std::remove_extent_t<T>;
+
+  // the object is released by the deleter if the counter can't be made
+  static DeleterRefCounter* Create(element_type* ptr, D deleter,
+                                   const Alloc& alloc);
+
+  void Dispose() override { Compressed<D>::Get()(this->ptr); }
+  void Destroy() override;
+
+ private:
+  DeleterRefCounter(element_type* ptr, D&& deleter, const Alloc& alloc)
+      : RefCounter<T, Count>(ptr),
+        Compressed<D>(std::move(deleter)),
+        Compressed<Alloc>(alloc) {}
+};
 }  // namespace util
 
+// Deletes the object with delete, the default deleter of the pointers
 template <class T>
-class UniquePtr {
+struct DefaultDelete {
+  DefaultDelete() = default;
+  template <class U,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  DefaultDelete(const DefaultDelete<U>&) {}
+
+  void operator()(T* ptr) const { delete ptr; }
+};
+
+// Deletes an array made by new[] with delete[]
+template <class T>
+struct DefaultDelete<T[]> {
+  DefaultDelete() = default;
+
+  void operator()(T* ptr) const { delete[] ptr; }
+};
+
+// Deleter D is called on the owned pointer; a stateless one takes no room,
+// so the pointer stays as wide as T*. UniquePtr<E[]> owns an array made by
+// new E[n], holds E* and gives access to the elements by index.
+template <class T, class D>
+class UniquePtr : private util::Compressed<D> {
+  using Deleter = util::Compressed<D>;
+
  public:
-  typedef T* pointer;
-  typedef T element_type;
+  typedef std::remove_extent_t<T> element_type;
+  typedef element_type* pointer;
+  typedef D deleter_type;
   typedef std::add_lvalue_reference<element_type> lreference_type;
 
-  UniquePtr() : ptr_(nullptr) {}
+  UniquePtr() : Deleter(D()), ptr_(nullptr) {}
   ~UniquePtr() { reset(nullptr); }
 
   UniquePtr(UniquePtr&) = delete;
-  UniquePtr(UniquePtr&& other);
+  UniquePtr(UniquePtr&& other) noexcept;
 
   UniquePtr& operator=(UniquePtr&) = delete;
-  UniquePtr& operator=(UniquePtr&& other);
+  UniquePtr& operator=(UniquePtr&& other) noexcept;
 
-  explicit UniquePtr(T* ptr) : ptr_(ptr) {}
+  explicit UniquePtr(pointer ptr) : Deleter(D()), ptr_(ptr) {}
+  UniquePtr(pointer ptr, const D& deleter) : Deleter(deleter), ptr_(ptr) {}
+  UniquePtr(pointer ptr, D&& deleter)
+      : Deleter(std::move(deleter)), ptr_(ptr) {}
 
-  T* get() const { return ptr_; }
-  T* operator->() const { return get(); }
+  pointer get() const { return ptr_; }
+  pointer operator->() const { return get(); }
   typename lreference_type::type operator*() const { return *get(); }
 
-  T* release();
-  void reset(T* ptr);
+  template <class U = T, class = std::enable_if_t<std::is_array_v<U>>>
+  typename lreference_type::type operator[](std::size_t i) const {
+    return get()[i];
+  }
+
+  D& get_deleter() { return Deleter::Get(); }
+  const D& get_deleter() const { return Deleter::Get(); }
+
+  pointer release();
+  void reset(pointer ptr);
   void reset(std::nullptr_t ptr = nullptr);
-  void swap(UniquePtr<T>& other);
+  void swap(UniquePtr& other) noexcept;
 
  private:
-  T* ptr_;
+  pointer ptr_;
 };
 
-template <class T>
+template <class T, class Count>
 class SharedPtr {
-  friend class WeakPtr<T>;
-  using Counter = util::RefCounter<T>;
+  friend class WeakPtr<T, Count>;
+  friend class AtomicSharedPtr<T>;
+  template <class U, class C, class Alloc, class... Args>
+  friend SharedPtr<U, C> AllocateShared(const Alloc& alloc, Args&&... args);
+
+  using Counter = util::RefCounter<T, Count>;
 
  public:
   typedef std::remove_extent_t<T> element_type;
   typedef std::add_lvalue_reference<element_type> lreference_type;
-  typedef WeakPtr<T> weak_type;
+  typedef WeakPtr<T, Count> weak_type;
 
   SharedPtr() : refCounter_(nullptr) {}
 
@@ -84,36 +349,64 @@ class SharedPtr {
   SharedPtr(const SharedPtr& other)
       : refCounter_(Counter::IncrementShared(other.refCounter_)) {}
 
-  SharedPtr(SharedPtr&& other)
-      : refCounter_(Counter::IncrementShared(other.refCounter_)) {}
+  // moves take over the reference without touching the counts
+  SharedPtr(SharedPtr&& other) noexcept : refCounter_(other.refCounter_) {
+    other.refCounter_ = nullptr;
+  }
   SharedPtr(const SharedPtr&& other)
       : refCounter_(Counter::IncrementShared(other.refCounter_)) {}
 
-  SharedPtr(const WeakPtr<T>& weak)
-      : refCounter_(Counter::IncrementShared(weak.refCounter_)) {}
+  // empty if the object is already deleted
+  SharedPtr(const WeakPtr<T, Count>& weak)
+      : refCounter_(Counter::LockShared(weak.refCounter_)) {}
+
+  // SharedPtr<E[]> takes an array made by new E[n]
+  explicit SharedPtr(element_type* ptr)
+      : refCounter_(Counter::SharedCounter(ptr)) {}
 
-  explicit SharedPtr(T* ptr) : refCounter_(Counter::SharedCounter(ptr)) {}
+  // release the object with deleter, e.g. back to a pool, instead of
+  // delete; alloc allocates the counter, which keeps both of them
+  template <class D, class Alloc = std::allocator<element_type>>
+  SharedPtr(element_type* ptr, D deleter, const Alloc& alloc = Alloc())
+      : refCounter_(util::DeleterRefCounter<T, Count, D, Alloc>::Create(
+            ptr, std::move(deleter), alloc)) {}
 
-  SharedPtr& operator=(SharedPtr& other);
-  SharedPtr& operator=(SharedPtr&& other);
+  SharedPtr& operator=(const SharedPtr& other);
+  SharedPtr& operator=(SharedPtr&& other) noexcept;
 
-  T* get() const { return Counter::GetPtr(refCounter_); }
+  element_type* get() const { return Counter::GetPtr(refCounter_); }
   typename lreference_type::type operator*() const { return *get(); }
-  T* operator->() const { return get(); }
+  element_type* operator->() const { return get(); }
+
+  template <class U = T, class = std::enable_if_t<std::is_array_v<U>>>
+  typename lreference_type::type operator[](std::ptrdiff_t i) const {
+    return get()[i];
+  }
 
   long use_count() const { return Counter::UseCount(refCounter_); }
 
-  void reset(T* ptr = nullptr);
-  void swap(SharedPtr& other);
+  void reset(element_type* ptr = nullptr);
+  template <class D, class Alloc = std::allocator<element_type>>
+  void reset(element_type* ptr, D deleter, const Alloc& alloc = Alloc()) {
+    SharedPtr(ptr, std::move(deleter), alloc).swap(*this);
+  }
+  // take over the reference of other, leaving it empty
+  void reset(SharedPtr&& other) noexcept;
+  void swap(SharedPtr& other) noexcept;
+  void swap(SharedPtr&& other) noexcept;
 
  private:
   Counter* refCounter_;
+
+  // adopt a counter holding one shared reference; the tag keeps
+  // SharedPtr(nullptr) unambiguous
+  SharedPtr(util::AdoptTag, Counter* counter) : refCounter_(counter) {}
 };
 
-template <class T>
+template <class T, class Count>
 class WeakPtr {
-  friend class SharedPtr<T>;
-  using Counter = util::RefCounter<T>;
+  friend class SharedPtr<T, Count>;
+  using Counter = util::RefCounter<T, Count>;
 
  public:
   typedef std::remove_extent_t<T> element_type;
@@ -123,29 +416,182 @@ class WeakPtr {
 
   WeakPtr(WeakPtr& other)
       : refCounter_(Counter::IncrementWeak(other.refCounter_)) {}
-  WeakPtr(WeakPtr&& other) : refCounter_(nullptr) {
+  WeakPtr(WeakPtr&& other) noexcept : refCounter_(nullptr) {
     std::swap(refCounter_, other.refCounter_);
   }
 
-  WeakPtr(const SharedPtr<T>& shared)
+  WeakPtr(const SharedPtr<T, Count>& shared)
       : refCounter_(Counter::IncrementWeak(shared.refCounter_)) {}
 
   WeakPtr& operator=(WeakPtr& other);
-  WeakPtr& operator=(WeakPtr&& other);
-  WeakPtr& operator=(SharedPtr<T>& shared);
+  WeakPtr& operator=(WeakPtr&& other) noexcept;
+  WeakPtr& operator=(SharedPtr<T, Count>& shared);
 
-  SharedPtr<T> lock() const { return SharedPtr<T>(*this); }
+  // safe to call while other threads drop the last SharedPtr
+  SharedPtr<T, Count> lock() const { return SharedPtr<T, Count>(*this); }
 
   long use_count() const { return Counter::UseCount(refCounter_); }
   bool expired() const { return (use_count() == 0); }
 
   void reset();
-  void swap(WeakPtr<T>& other);
+  void swap(WeakPtr& other) noexcept;
 
  private:
   Counter* refCounter_;
 };
 
+// SharedPtr that many threads may load and store at once. The counter
+// pointer shares one atomic word with a local count of loads in progress:
+// a load first takes a local reference with a single fetch_add, then
+// makes a regular one and gives the local one back; a store moves the
+// local references of the old counter into its use count. No thread ever
+// waits for another, so readers are lock-free. Counters are expected to
+// fit in the low 48 bits of a pointer, as on x86-64 and AArch64.
+template <class T>
+class AtomicSharedPtr {
+  using Counter = util::RefCounter<T, util::AtomicCount>;
+
+ public:
+  AtomicSharedPtr() noexcept : word_(0) {}
+  AtomicSharedPtr(SharedPtr<T> desired) noexcept : word_(Pack(desired)) {}
+  ~AtomicSharedPtr() { Release(word_.load(std::memory_order_acquire)); }
+
+  AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+  AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+  AtomicSharedPtr& operator=(SharedPtr<T> desired) {
+    store(std::move(desired));
+    return *this;
+  }
+  operator SharedPtr<T>() const { return load(); }
+
+  bool is_lock_free() const { return word_.is_lock_free(); }
+
+  SharedPtr<T> load() const;
+  void store(SharedPtr<T> desired);
+  SharedPtr<T> exchange(SharedPtr<T> desired);
+
+  // store desired if the pointer shares the object of expected, otherwise
+  // load the pointer into expected
+  bool compare_exchange_strong(SharedPtr<T>& expected, SharedPtr<T> desired);
+  bool compare_exchange_weak(SharedPtr<T>& expected, SharedPtr<T> desired) {
+    return compare_exchange_strong(expected, std::move(desired));
+  }
+
+ private:
+  static_assert(sizeof(uintptr_t) == 8, "pointers must be 64 bits wide");
+
+  static constexpr int kCountShift = 48;
+  static constexpr uintptr_t kLocalOne = uintptr_t(1) << kCountShift;
+  static constexpr uintptr_t kPointerMask = kLocalOne - 1;
+
+  static Counter* CounterOf(uintptr_t word) {
+    return reinterpret_cast<Counter*>(word & kPointerMask);
+  }
+  static long LocalCount(uintptr_t word) { return word >> kCountShift; }
+
+  // take over the reference of ptr
+  static uintptr_t Pack(SharedPtr<T>& ptr) {
+    uintptr_t word = reinterpret_cast<uintptr_t>(ptr.refCounter_);
+    ptr.refCounter_ = nullptr;
+    return word;
+  }
+
+  // turn the local references of a replaced word into regular ones and
+  // drop the reference the word itself held
+  static void Release(uintptr_t word);
+
+  mutable std::atomic<uintptr_t> word_;
+};
+
+// Base class keeping the count of IntrusivePtrs inside the object:
+//   class Widget : public RefCounted<Widget> { ... };
+// Other classes may provide the same hooks as the hidden friends below,
+// IntrusiveAddRef(T*) and IntrusiveRelease(T*), found by argument-dependent
+// lookup. Copies of an object start with no references.
+template <class Derived, class Count = util::AtomicCount>
+class RefCounted {
+ public:
+  long use_count() const { return count_.Load(); }
+
+ protected:
+  RefCounted() : count_(0) {}
+  RefCounted(const RefCounted&) : count_(0) {}
+  RefCounted& operator=(const RefCounted&) { return *this; }
+  ~RefCounted() = default;
+
+ private:
+  mutable Count count_;
+
+  friend void IntrusiveAddRef(const Derived* object) {
+    static_cast<const RefCounted*>(object)->count_.Increment();
+  }
+
+  // delete the object with the last reference
+  friend void IntrusiveRelease(const Derived* object) {
+    if (static_cast<const RefCounted*>(object)->count_.Decrement() == 0) {
+      delete object;
+    }
+  }
+};
+
+// Pointer to an object that counts its references itself, one pointer
+// wide and with no separate counter
+template <class T>
+class IntrusivePtr {
+  template <class U>
+  friend class IntrusivePtr;
+
+ public:
+  typedef T element_type;
+  typedef std::add_lvalue_reference<element_type> lreference_type;
+
+  IntrusivePtr() noexcept : ptr_(nullptr) {}
+  ~IntrusivePtr() { Release(ptr_); }
+
+  // add_ref = false adopts a reference taken before, e.g. by detach()
+  explicit IntrusivePtr(T* ptr, bool add_ref = true) : ptr_(ptr) {
+    if (ptr_ != nullptr && add_ref) {
+      IntrusiveAddRef(ptr_);
+    }
+  }
+
+  IntrusivePtr(const IntrusivePtr& other) : IntrusivePtr(other.ptr_) {}
+  IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(other.ptr_) {
+    other.ptr_ = nullptr;
+  }
+
+  template <class U,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  IntrusivePtr(const IntrusivePtr<U>& other) : IntrusivePtr(other.ptr_) {}
+  template <class U,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  IntrusivePtr(IntrusivePtr<U>&& other) noexcept : ptr_(other.ptr_) {
+    other.ptr_ = nullptr;
+  }
+
+  IntrusivePtr& operator=(const IntrusivePtr& other);
+  IntrusivePtr& operator=(IntrusivePtr&& other) noexcept;
+
+  T* get() const { return ptr_; }
+  T* operator->() const { return get(); }
+  typename lreference_type::type operator*() const { return *get(); }
+
+  // give up the reference without releasing it
+  T* detach();
+  void reset(T* ptr = nullptr);
+  void swap(IntrusivePtr& other) noexcept;
+
+ private:
+  T* ptr_;
+
+  static void Release(T* ptr) {
+    if (ptr != nullptr) {
+      IntrusiveRelease(ptr);
+    }
+  }
+};
+
 }  // namespace task
 
 #include "smart_pointers.tpp"
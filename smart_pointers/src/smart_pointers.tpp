@@ -2,163 +2,303 @@ namespace task {
 
 namespace util {
 
-template <class T>
-T* RefCounter<T>::GetPtr(RefCounter<T>* counter) {
+template <class T, class Count>
+typename RefCounter<T, Count>::element_type* RefCounter<T, Count>::GetPtr(
+    RefCounter* counter) {
   return (counter == nullptr) ? nullptr : counter->ptr;
 };
 
-template <class T>
-long RefCounter<T>::UseCount(RefCounter<T>* counter) {
-  return (counter == nullptr) ? 0 : counter->use_count;
+template <class T, class Count>
+long RefCounter<T, Count>::UseCount(RefCounter* counter) {
+  return (counter == nullptr) ? 0 : counter->use_count.Load();
 };
 
-template <class T>
-long RefCounter<T>::WeakCount(RefCounter<T>* counter) {
-  return (counter == nullptr) ? 0 : counter->weak_count;
+template <class T, class Count>
+long RefCounter<T, Count>::WeakCount(RefCounter* counter) {
+  if (counter == nullptr) {
+    return 0;
+  }
+  long shared = counter->use_count.Load() != 0 ? 1 : 0;
+  return counter->weak_count.Load() - shared;
 };
 
-template <class T>
-RefCounter<T>* RefCounter<T>::SharedCounter(T* ptr) {
-  auto counter = new RefCounter();
-  counter->ptr = ptr;
-  counter->use_count = 1;
-  counter->weak_count = 0;
-  return counter;
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::SharedCounter(
+    element_type* ptr) {
+  return new RefCounter(ptr);
 };
 
-template <class T>
-RefCounter<T>* RefCounter<T>::IncrementShared(RefCounter<T>* counter) {
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::IncrementShared(
+    RefCounter* counter) {
   if (counter != nullptr) {
-    counter->use_count++;
+    counter->use_count.Increment();
   }
   return counter;
 };
 
-template <class T>
-RefCounter<T>* RefCounter<T>::DecrementShared(RefCounter<T>* counter) {
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::DecrementShared(
+    RefCounter* counter) {
   if (counter == nullptr) {
     return nullptr;
   }
 
-  if (--counter->use_count == 0) {
-    if (counter->ptr != nullptr) {
-      delete counter->ptr;
-      counter->ptr = nullptr;
-    }
-    if (counter->weak_count == 0) {
-      delete counter;
-    }
+  if (counter->use_count.Decrement() == 0) {
+    // a custom deleter runs even for nullptr, DefaultDelete ignores it
+    counter->Dispose();
+    // drop the weak reference of the shared ones
+    DecrementWeak(counter);
     return nullptr;
   }
   return counter;
 };
 
-template <class T>
-RefCounter<T>* RefCounter<T>::IncrementWeak(RefCounter<T>* counter) {
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::LockShared(RefCounter* counter) {
+  if (counter == nullptr || !counter->use_count.IncrementIfNotZero()) {
+    return nullptr;
+  }
+  return counter;
+};
+
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::IncrementWeak(
+    RefCounter* counter) {
   if (counter != nullptr) {
-    counter->weak_count++;
+    counter->weak_count.Increment();
   }
   return counter;
 };
 
-template <class T>
-RefCounter<T>* RefCounter<T>::DecrementWeak(RefCounter<T>* counter) {
+template <class T, class Count>
+RefCounter<T, Count>* RefCounter<T, Count>::DecrementWeak(
+    RefCounter* counter) {
   if (counter == nullptr) {
     return nullptr;
   }
 
-  if (--counter->weak_count == 0 && counter->use_count == 0) {
-    if (counter->ptr != nullptr) {
-      delete counter->ptr;
-    }
-    delete counter;
+  if (counter->weak_count.Decrement() == 0) {
+    counter->Destroy();
     return nullptr;
   }
   return counter;
 };
 
+template <class T, class Count, class Alloc>
+template <class... Args>
+InplaceRefCounter<T, Count, Alloc>* InplaceRefCounter<T, Count, Alloc>::Create(
+    const Alloc& alloc, Args&&... args) {
+  Allocator allocator(alloc);
+  InplaceRefCounter* counter = Traits::allocate(allocator, 1);
+  ::new (static_cast<void*>(counter)) InplaceRefCounter(alloc);
+  try {
+    counter->ptr = ::new (static_cast<void*>(counter->storage_))
+        T(std::forward<Args>(args)...);
+  } catch (...) {
+    counter->~InplaceRefCounter();
+    Traits::deallocate(allocator, counter, 1);
+    throw;
+  }
+  return counter;
+};
+
+template <class T, class Count, class Alloc>
+void InplaceRefCounter<T, Count, Alloc>::Destroy() {
+  Allocator allocator(this->Get());
+  this->~InplaceRefCounter();
+  Traits::deallocate(allocator, this, 1);
+};
+
+template <class E, class Count, class Alloc>
+template <class... Args>
+InplaceArrayRefCounter<E, Count, Alloc>*
+InplaceArrayRefCounter<E, Count, Alloc>::Create(const Alloc& alloc,
+                                                std::size_t size,
+                                                const Args&... args) {
+  Allocator allocator(alloc);
+  InplaceArrayRefCounter* counter =
+      Traits::allocate(allocator, Units(size));
+  ::new (static_cast<void*>(counter)) InplaceArrayRefCounter(alloc, size);
+  E* elements = reinterpret_cast<E*>(counter + 1);
+  std::size_t made = 0;
+  try {
+    for (; made < size; ++made) {
+      ::new (static_cast<void*>(elements + made)) E(args...);
+    }
+  } catch (...) {
+    counter->DestroyElements(made);
+    counter->~InplaceArrayRefCounter();
+    Traits::deallocate(allocator, counter, Units(size));
+    throw;
+  }
+  counter->ptr = elements;
+  return counter;
+};
+
+template <class E, class Count, class Alloc>
+void InplaceArrayRefCounter<E, Count, Alloc>::Dispose() {
+  DestroyElements(size_);
+};
+
+template <class E, class Count, class Alloc>
+void InplaceArrayRefCounter<E, Count, Alloc>::Destroy() {
+  Allocator allocator(this->Get());
+  std::size_t units = Units(size_);
+  this->~InplaceArrayRefCounter();
+  Traits::deallocate(allocator, this, units);
+};
+
+template <class E, class Count, class Alloc>
+std::size_t InplaceArrayRefCounter<E, Count, Alloc>::Units(std::size_t size) {
+  const std::size_t unit = sizeof(InplaceArrayRefCounter);
+  if (size > (SIZE_MAX - unit) / sizeof(E)) {
+    throw std::bad_array_new_length();
+  }
+  return 1 + (size * sizeof(E) + unit - 1) / unit;
+};
+
+template <class E, class Count, class Alloc>
+void InplaceArrayRefCounter<E, Count, Alloc>::DestroyElements(
+    std::size_t count) {
+  E* elements = reinterpret_cast<E*>(this + 1);
+  while (count != 0) {
+    elements[--count].~E();
+  }
+};
+
+template <class T, class Count, class D, class Alloc>
+DeleterRefCounter<T, Count, D, Alloc>*
+DeleterRefCounter<T, Count, D, Alloc>::Create(element_type* ptr, D deleter,
+                                              const Alloc& alloc) {
+  Allocator allocator(alloc);
+  DeleterRefCounter* counter = nullptr;
+  try {
+    counter = Traits::allocate(allocator, 1);
+  } catch (...) {
+    deleter(ptr);
+    throw;
+  }
+  return ::new (static_cast<void*>(counter))
+      DeleterRefCounter(ptr, std::move(deleter), alloc);
+};
+
+template <class T, class Count, class D, class Alloc>
+void DeleterRefCounter<T, Count, D, Alloc>::Destroy() {
+  Allocator allocator(Compressed<Alloc>::Get());
+  this->~DeleterRefCounter();
+  Traits::deallocate(allocator, this, 1);
+};
+
 }  // namespace util
 
-template <class T>
-UniquePtr<T>::UniquePtr(UniquePtr<T>&& other) {
-  ptr_ = std::move(other.ptr_);
+template <class T, class Count, class Alloc, class... Args>
+SharedPtr<T, Count> AllocateShared(const Alloc& alloc, Args&&... args) {
+  if constexpr (std::is_array_v<T>) {
+    static_assert(std::extent_v<T> == 0, "use E[] instead of E[N]");
+    using Counter =
+        util::InplaceArrayRefCounter<std::remove_extent_t<T>, Count, Alloc>;
+    return SharedPtr<T, Count>(util::AdoptTag(),
+                               Counter::Create(alloc, args...));
+  } else {
+    using Counter = util::InplaceRefCounter<T, Count, Alloc>;
+    return SharedPtr<T, Count>(
+        util::AdoptTag(), Counter::Create(alloc, std::forward<Args>(args)...));
+  }
+};
+
+template <class T, class Count, class... Args>
+SharedPtr<T, Count> MakeShared(Args&&... args) {
+  return AllocateShared<T, Count>(std::allocator<std::remove_extent_t<T>>(),
+                                  std::forward<Args>(args)...);
+};
+
+template <class T, class D>
+UniquePtr<T, D>::UniquePtr(UniquePtr&& other) noexcept
+    : Deleter(std::move(other.get_deleter())), ptr_(other.ptr_) {
   other.ptr_ = nullptr;
 };
 
-template <class T>
-UniquePtr<T>& UniquePtr<T>::operator=(UniquePtr<T>&& other) {
+template <class T, class D>
+UniquePtr<T, D>& UniquePtr<T, D>::operator=(UniquePtr&& other) noexcept {
   if (this == &other) {
     return *this;
   }
 
-  release();
-  std::swap(ptr_, other.ptr_);
+  reset(other.release());
+  get_deleter() = std::move(other.get_deleter());
   return *this;
 };
 
-template <class T>
-T* UniquePtr<T>::release() {
-  T* tmp = nullptr;
+template <class T, class D>
+typename UniquePtr<T, D>::pointer UniquePtr<T, D>::release() {
+  pointer tmp = nullptr;
   std::swap(ptr_, tmp);
   return tmp;
 };
 
-template <class T>
-void UniquePtr<T>::reset(T* ptr) {
+template <class T, class D>
+void UniquePtr<T, D>::reset(pointer ptr) {
   auto tmp = ptr_;
   ptr_ = ptr;
   if (tmp != nullptr) {
-    delete tmp;
+    get_deleter()(tmp);
   }
 };
 
-template <class T>
-void UniquePtr<T>::reset(std::nullptr_t ptr) {
-  if (ptr_ != nullptr) {
-    delete ptr_;
-  }
-  ptr_ = nullptr;
+template <class T, class D>
+void UniquePtr<T, D>::reset(std::nullptr_t) {
+  reset(static_cast<pointer>(nullptr));
 };
 
-template <class T>
-void UniquePtr<T>::swap(UniquePtr<T>& other) {
+template <class T, class D>
+void UniquePtr<T, D>::swap(UniquePtr& other) noexcept {
   std::swap(ptr_, other.ptr_);
+  std::swap(get_deleter(), other.get_deleter());
 };
 
-template <class T>
-SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr<T>& other) {
-  if (this != &other) {
-    Counter::DecrementShared(refCounter_);
-    refCounter_ = Counter::IncrementShared(other.refCounter_);
-  }
+template <class T, class Count>
+SharedPtr<T, Count>& SharedPtr<T, Count>::operator=(const SharedPtr& other) {
+  // the old object may own other, so it is released last
+  SharedPtr(other).swap(*this);
   return *this;
 };
 
-template <class T>
-SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr<T>&& other) {
-  if (this != &other) {
-    Counter::DecrementShared(refCounter_);
-    refCounter_ = nullptr;
-    std::swap(refCounter_, other.refCounter_);
-  }
+template <class T, class Count>
+SharedPtr<T, Count>& SharedPtr<T, Count>::operator=(
+    SharedPtr&& other) noexcept {
+  reset(std::move(other));
   return *this;
 };
 
-template <class T>
-void SharedPtr<T>::reset(T* ptr) {
-  refCounter_ = Counter::DecrementShared(refCounter_);
+template <class T, class Count>
+void SharedPtr<T, Count>::reset(element_type* ptr) {
+  Counter::DecrementShared(refCounter_);
+  refCounter_ = nullptr;
   if (ptr != nullptr) {
     refCounter_ = Counter::SharedCounter(ptr);
   }
 };
 
-template <class T>
-void SharedPtr<T>::swap(SharedPtr& other) {
+template <class T, class Count>
+void SharedPtr<T, Count>::reset(SharedPtr&& other) noexcept {
+  // take other over before releasing the old object, which may own it,
+  // as in head = std::move(head->next)
+  SharedPtr(std::move(other)).swap(*this);
+};
+
+template <class T, class Count>
+void SharedPtr<T, Count>::swap(SharedPtr& other) noexcept {
   std::swap(refCounter_, other.refCounter_);
 };
 
-template <class T>
-WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<T>& other) {
+template <class T, class Count>
+void SharedPtr<T, Count>::swap(SharedPtr&& other) noexcept {
+  std::swap(refCounter_, other.refCounter_);
+};
+
+template <class T, class Count>
+WeakPtr<T, Count>& WeakPtr<T, Count>::operator=(WeakPtr& other) {
   if (this != &other) {
     Counter::DecrementWeak(refCounter_);
     refCounter_ = Counter::IncrementWeak(other.refCounter_);
@@ -166,8 +306,8 @@ WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<T>& other) {
   return *this;
 };
 
-template <class T>
-WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<T>&& other) {
+template <class T, class Count>
+WeakPtr<T, Count>& WeakPtr<T, Count>::operator=(WeakPtr&& other) noexcept {
   if (this != &other) {
     Counter::DecrementWeak(refCounter_);
     refCounter_ = nullptr;
@@ -176,22 +316,118 @@ WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<T>&& other) {
   return *this;
 };
 
-template <class T>
-WeakPtr<T>& WeakPtr<T>::operator=(SharedPtr<T>& shared) {
+template <class T, class Count>
+WeakPtr<T, Count>& WeakPtr<T, Count>::operator=(
+    SharedPtr<T, Count>& shared) {
   Counter::DecrementWeak(refCounter_);
   refCounter_ = Counter::IncrementWeak(shared.refCounter_);
   return *this;
 };
 
-template <class T>
-void WeakPtr<T>::reset() {
+template <class T, class Count>
+void WeakPtr<T, Count>::reset() {
   Counter::DecrementWeak(refCounter_);
   refCounter_ = nullptr;
 };
 
-template <class T>
-void WeakPtr<T>::swap(WeakPtr<T>& other) {
+template <class T, class Count>
+void WeakPtr<T, Count>::swap(WeakPtr& other) noexcept {
   std::swap(refCounter_, other.refCounter_);
 };
 
+template <class T>
+SharedPtr<T> AtomicSharedPtr<T>::load() const {
+  uintptr_t word =
+      word_.fetch_add(kLocalOne, std::memory_order_acquire) + kLocalOne;
+  Counter* counter = CounterOf(word);
+  // the local reference keeps the counter alive while the regular one
+  // is made
+  Counter::IncrementShared(counter);
+  while (CounterOf(word) == counter && LocalCount(word) != 0) {
+    if (word_.compare_exchange_weak(word, word - kLocalOne,
+                                    std::memory_order_release,
+                                    std::memory_order_relaxed)) {
+      return SharedPtr<T>(util::AdoptTag(), counter);
+    }
+  }
+  // the word was replaced and the local reference became a regular one
+  Counter::DecrementShared(counter);
+  return SharedPtr<T>(util::AdoptTag(), counter);
+};
+
+template <class T>
+void AtomicSharedPtr<T>::store(SharedPtr<T> desired) {
+  Release(word_.exchange(Pack(desired), std::memory_order_acq_rel));
+};
+
+template <class T>
+SharedPtr<T> AtomicSharedPtr<T>::exchange(SharedPtr<T> desired) {
+  uintptr_t word = word_.exchange(Pack(desired), std::memory_order_acq_rel);
+  Counter* counter = CounterOf(word);
+  if (counter != nullptr && LocalCount(word) != 0) {
+    counter->use_count.Add(LocalCount(word));
+  }
+  // the reference of the word goes to the caller
+  return SharedPtr<T>(util::AdoptTag(), counter);
+};
+
+template <class T>
+bool AtomicSharedPtr<T>::compare_exchange_strong(SharedPtr<T>& expected,
+                                                 SharedPtr<T> desired) {
+  uintptr_t replacement = reinterpret_cast<uintptr_t>(desired.refCounter_);
+  uintptr_t word = word_.load(std::memory_order_acquire);
+  while (CounterOf(word) == expected.refCounter_) {
+    if (word_.compare_exchange_weak(word, replacement,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+      Pack(desired);
+      Release(word);
+      return true;
+    }
+  }
+  expected = load();
+  return false;
+};
+
+template <class T>
+void AtomicSharedPtr<T>::Release(uintptr_t word) {
+  Counter* counter = CounterOf(word);
+  if (counter == nullptr) {
+    return;
+  }
+  if (LocalCount(word) != 0) {
+    counter->use_count.Add(LocalCount(word));
+  }
+  Counter::DecrementShared(counter);
+};
+
+template <class T>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(const IntrusivePtr& other) {
+  IntrusivePtr(other).swap(*this);
+  return *this;
+};
+
+template <class T>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(IntrusivePtr&& other) noexcept {
+  IntrusivePtr(std::move(other)).swap(*this);
+  return *this;
+};
+
+template <class T>
+T* IntrusivePtr<T>::detach() {
+  T* tmp = nullptr;
+  std::swap(ptr_, tmp);
+  return tmp;
+};
+
+template <class T>
+void IntrusivePtr<T>::reset(T* ptr) {
+  IntrusivePtr(ptr).swap(*this);
+};
+
+template <class T>
+void IntrusivePtr<T>::swap(IntrusivePtr& other) noexcept {
+  std::swap(ptr_, other.ptr_);
+};
+
 }  // namespace task
\ No newline at end of file
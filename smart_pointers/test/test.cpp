@@ -1,11 +1,22 @@
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <random>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "../src/smart_pointers.h"
 
+using task::AllocateShared;
+using task::AtomicSharedPtr;
+using task::IntrusivePtr;
+using task::LocalSharedPtr;
+using task::LocalWeakPtr;
+using task::MakeShared;
+using task::RefCounted;
 using task::SharedPtr;
 using task::UniquePtr;
 using task::WeakPtr;
@@ -39,6 +50,88 @@ struct Node {
   ~Node() {}
 };
 
+struct Counted {
+  static std::atomic<int> alive;
+  int value;
+  Counted(int value) : value(value) { ++alive; }
+  Counted(const Counted& other) : value(other.value) { ++alive; }
+  ~Counted() { --alive; }
+};
+
+std::atomic<int> Counted::alive{0};
+
+struct Widget : RefCounted<Widget> {
+  Counted counted;
+  Widget(int value) : counted(value) {}
+};
+
+struct LocalWidget : RefCounted<LocalWidget, task::util::PlainCount> {
+  Counted counted;
+  LocalWidget(int value) : counted(value) {}
+};
+
+// counts its references through the hooks instead of the base class
+struct Handle {
+  int references = 0;
+  bool* released;
+};
+
+void IntrusiveAddRef(Handle* handle) { ++handle->references; }
+
+void IntrusiveRelease(Handle* handle) {
+  if (--handle->references == 0) {
+    *handle->released = true;
+  }
+}
+
+// hands out objects from a fixed array and takes them back
+struct CountedPool {
+  std::vector<Counted*> free;
+  int returned = 0;
+
+  Counted* Take() {
+    Counted* result = free.back();
+    free.pop_back();
+    return result;
+  }
+};
+
+struct PoolDeleter {
+  CountedPool* pool;
+  void operator()(Counted* ptr) const {
+    pool->free.push_back(ptr);
+    ++pool->returned;
+  }
+};
+
+// std::allocator that counts its calls
+template <class T>
+struct CountingAllocator {
+  typedef T value_type;
+
+  static int allocations;
+  static int deallocations;
+
+  CountingAllocator() = default;
+  template <class U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    ++CountingAllocator<void>::allocations;
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    ++CountingAllocator<void>::deallocations;
+    std::allocator<T>().deallocate(p, n);
+  }
+};
+
+template <class T>
+int CountingAllocator<T>::allocations = 0;
+template <class T>
+int CountingAllocator<T>::deallocations = 0;
+
 SharedPtr<Node> getCyclePtr(int cycleSize) {
   SharedPtr<Node> head(new Node(0));
   SharedPtr<Node> prev(head);
@@ -194,4 +287,400 @@ int main() {
       ASSERT_TRUE(nextHead.use_count() == 1);
     }
   }
+
+  {
+    auto shared = SharedPtr<Counted>(new Counted(7));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 8; ++t) {
+      workers.emplace_back([&shared] {
+        std::vector<SharedPtr<Counted>> copies;
+        for (int i = 0; i < 100'000; ++i) {
+          copies.push_back(shared);
+          if (copies.size() == 100) {
+            copies.clear();
+          }
+        }
+        WeakPtr<Counted> weak = shared;
+        ASSERT_TRUE(weak.lock()->value == 7);
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    ASSERT_TRUE(shared.use_count() == 1);
+
+    // the last owner goes away while another thread locks weak pointers
+    for (int i = 0; i < 1'000; ++i) {
+      auto owner = SharedPtr<Counted>(new Counted(i));
+      WeakPtr<Counted> weak = owner;
+      std::thread locker([weak, i]() mutable {
+        while (true) {
+          SharedPtr<Counted> locked = weak.lock();
+          if (locked.get() == nullptr) {
+            break;
+          }
+          ASSERT_TRUE(locked->value == i);
+        }
+        ASSERT_TRUE(weak.expired());
+      });
+      owner.reset();
+      locker.join();
+    }
+    shared.reset();
+    ASSERT_TRUE(Counted::alive == 0);
+  }
+
+  {
+    auto local = LocalSharedPtr<Counted>(new Counted(5));
+    LocalWeakPtr<Counted> weak = local;
+    auto copy = local;
+    ASSERT_TRUE(local.use_count() == 2);
+    ASSERT_TRUE(weak.lock()->value == 5);
+    local.reset();
+    copy.reset();
+    ASSERT_TRUE(weak.expired());
+    ASSERT_TRUE(weak.lock().get() == nullptr);
+    ASSERT_TRUE(Counted::alive == 0);
+  }
+  {
+    auto made = MakeShared<std::string>(10, 'a');
+    auto copy = made;
+    ASSERT_TRUE(*made == "aaaaaaaaaa" && copy.use_count() == 2);
+    auto local = MakeShared<Counted, task::util::PlainCount>(3);
+    ASSERT_TRUE(local->value == 3 && Counted::alive == 1);
+    local.reset();
+    ASSERT_TRUE(Counted::alive == 0);
+
+    using Counter = CountingAllocator<void>;
+    WeakPtr<Counted> weak;
+    {
+      auto shared = AllocateShared<Counted>(CountingAllocator<Counted>(), 4);
+      weak = shared;
+      auto other = shared;
+      ASSERT_TRUE(other->value == 4 && shared.use_count() == 2);
+      ASSERT_TRUE(Counter::allocations == 1);
+    }
+    // the object goes with the last SharedPtr, its storage with the last
+    // WeakPtr
+    ASSERT_TRUE(Counted::alive == 0 && weak.expired());
+    ASSERT_TRUE(Counter::deallocations == 0);
+    weak.reset();
+    ASSERT_TRUE(Counter::deallocations == 1);
+
+    struct Throwing {
+      Throwing() { throw std::runtime_error("constructor"); }
+    };
+    bool thrown = false;
+    try {
+      AllocateShared<Throwing>(CountingAllocator<Throwing>());
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+    ASSERT_TRUE(Counter::allocations == 2 && Counter::deallocations == 2);
+  }
+  {
+    static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+    static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+    static_assert(std::is_nothrow_move_constructible_v<WeakPtr<int>>);
+
+    auto shared = MakeShared<int>(8);
+    SharedPtr<int> moved(std::move(shared));
+    ASSERT_TRUE(shared.get() == nullptr && shared.use_count() == 0);
+    ASSERT_TRUE(*moved == 8 && moved.use_count() == 1);
+
+    // growing vectors move their elements without touching the counts
+    std::vector<SharedPtr<int>> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+      ptrs.push_back(std::move(moved));
+      moved = std::move(ptrs.back());
+      ptrs.back() = moved;
+      ASSERT_TRUE(moved.use_count() == i + 2);
+    }
+
+    SharedPtr<int> other = MakeShared<int>(9);
+    other.reset(std::move(moved));
+    ASSERT_TRUE(*other == 8 && moved.get() == nullptr);
+    ASSERT_TRUE(other.use_count() == 1001);
+    other = std::move(other);
+    ASSERT_TRUE(other.use_count() == 1001);
+    other.swap(SharedPtr<int>());
+    ASSERT_TRUE(other.get() == nullptr && ptrs[0].use_count() == 1000);
+  }
+  {
+    AtomicSharedPtr<int> atomic;
+    ASSERT_TRUE(atomic.is_lock_free());
+    ASSERT_TRUE(atomic.load().get() == nullptr);
+
+    auto first = MakeShared<int>(1);
+    atomic.store(first);
+    ASSERT_TRUE(first.use_count() == 2);
+    {
+      SharedPtr<int> loaded = atomic.load();
+      ASSERT_TRUE(*loaded == 1 && first.use_count() == 3);
+    }
+    ASSERT_TRUE(first.use_count() == 2);
+
+    SharedPtr<int> old = atomic.exchange(MakeShared<int>(2));
+    ASSERT_TRUE(old.get() == first.get() && first.use_count() == 2);
+    ASSERT_TRUE(*atomic.load() == 2);
+
+    SharedPtr<int> expected = first;
+    ASSERT_TRUE(!atomic.compare_exchange_strong(expected, MakeShared<int>(3)));
+    ASSERT_TRUE(*expected == 2);
+    ASSERT_TRUE(atomic.compare_exchange_weak(expected, first));
+    ASSERT_TRUE(*atomic.load() == 1 && expected.use_count() == 1);
+    old.reset();
+    expected.reset();
+
+    atomic = SharedPtr<int>();
+    ASSERT_TRUE(first.use_count() == 1);
+  }
+
+  {
+    // readers see every snapshot whole while the writer replaces them
+    AtomicSharedPtr<Counted> config(MakeShared<Counted>(0));
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+      readers.emplace_back([&config, &done] {
+        int last = 0;
+        while (!done) {
+          SharedPtr<Counted> snapshot = config;
+          ASSERT_TRUE(snapshot->value >= last);
+          last = snapshot->value;
+        }
+      });
+    }
+    for (int i = 1; i <= 100'000; ++i) {
+      if (i % 2 == 0) {
+        config.store(MakeShared<Counted>(i));
+      } else {
+        SharedPtr<Counted> expected = config.load();
+        ASSERT_TRUE(
+            config.compare_exchange_strong(expected, MakeShared<Counted>(i)));
+      }
+    }
+    done = true;
+    for (auto& reader : readers) {
+      reader.join();
+    }
+    ASSERT_TRUE(config.load()->value == 100'000);
+    config.store(SharedPtr<Counted>());
+    ASSERT_TRUE(Counted::alive == 0);
+  }
+  {
+    static_assert(sizeof(IntrusivePtr<Widget>) == sizeof(Widget*));
+
+    IntrusivePtr<Widget> widget(new Widget(6));
+    ASSERT_TRUE(widget->use_count() == 1 && widget->counted.value == 6);
+    {
+      IntrusivePtr<Widget> copy = widget;
+      IntrusivePtr<Widget> raw(widget.get());
+      ASSERT_TRUE(widget->use_count() == 3);
+    }
+    IntrusivePtr<Widget> moved = std::move(widget);
+    ASSERT_TRUE(widget.get() == nullptr && moved->use_count() == 1);
+
+    // copies of the object do not share its references
+    Widget copy = *moved;
+    ASSERT_TRUE(copy.use_count() == 0);
+
+    Widget* detached = moved.detach();
+    ASSERT_TRUE(moved.get() == nullptr && detached->use_count() == 1);
+    moved = IntrusivePtr<Widget>(detached, false);
+    ASSERT_TRUE(moved->use_count() == 1);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t) {
+      workers.emplace_back([&moved] {
+        for (int i = 0; i < 100'000; ++i) {
+          IntrusivePtr<Widget> local = moved;
+          ASSERT_TRUE(local->counted.value == 6);
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    ASSERT_TRUE(moved->use_count() == 1);
+    moved.reset(new Widget(7));
+    ASSERT_TRUE(Counted::alive == 2 && moved->counted.value == 7);
+  }
+  ASSERT_TRUE(Counted::alive == 0);
+
+  {
+    IntrusivePtr<LocalWidget> local(new LocalWidget(1));
+    auto copy = local;
+    ASSERT_TRUE(local->use_count() == 2);
+    local.reset();
+    copy.reset();
+    ASSERT_TRUE(Counted::alive == 0);
+
+    bool released = false;
+    Handle handle{0, &released};
+    {
+      IntrusivePtr<Handle> first(&handle);
+      IntrusivePtr<Handle> second = first;
+      ASSERT_TRUE(handle.references == 2);
+    }
+    ASSERT_TRUE(released && handle.references == 0);
+  }
+  {
+    auto noop = [](Counted*) {};
+    static_assert(sizeof(UniquePtr<int>) == sizeof(int*));
+    static_assert(sizeof(UniquePtr<Counted, decltype(noop)>) ==
+                  sizeof(Counted*));
+
+    {
+      auto first = UniquePtr<Counted>(new Counted(1));
+      auto second = UniquePtr<Counted>(new Counted(2));
+      first = std::move(second);
+      ASSERT_TRUE(first->value == 2 && Counted::alive == 1);
+    }
+    ASSERT_TRUE(Counted::alive == 0);
+
+    std::vector<Counted> storage{Counted(0), Counted(1), Counted(2)};
+    CountedPool pool;
+    for (Counted& counted : storage) {
+      pool.free.push_back(&counted);
+    }
+    {
+      UniquePtr<Counted, PoolDeleter> unique(pool.Take(), PoolDeleter{&pool});
+      ASSERT_TRUE(unique->value == 2 && unique.get_deleter().pool == &pool);
+      UniquePtr<Counted, PoolDeleter> other(std::move(unique));
+      ASSERT_TRUE(unique.get() == nullptr && pool.free.size() == 2);
+      other.reset(pool.Take());
+      ASSERT_TRUE(pool.returned == 1 && other->value == 1);
+    }
+    ASSERT_TRUE(pool.returned == 2 && pool.free.size() == 3);
+
+    using Counter = CountingAllocator<void>;
+    int allocations = Counter::allocations;
+    WeakPtr<Counted> weak;
+    {
+      SharedPtr<Counted> shared(pool.Take(), PoolDeleter{&pool},
+                                CountingAllocator<Counted>());
+      weak = shared;
+      auto copy = shared;
+      ASSERT_TRUE(Counter::allocations == allocations + 1);
+    }
+    ASSERT_TRUE(pool.returned == 3 && weak.expired());
+    ASSERT_TRUE(Counter::deallocations == allocations);
+    weak.reset();
+    ASSERT_TRUE(Counter::deallocations == allocations + 1);
+
+    SharedPtr<Counted> shared;
+    shared.reset(pool.Take(), PoolDeleter{&pool});
+    shared.reset(pool.Take(), noop);
+    ASSERT_TRUE(pool.returned == 4 && pool.free.size() == 2);
+
+    // deleters of empty pointers run too, e.g. to return a handle
+    int calls = 0;
+    auto count = [&calls](Counted*) { ++calls; };
+    {
+      SharedPtr<Counted> empty(nullptr, count);
+      auto copy = empty;
+      ASSERT_TRUE(copy.get() == nullptr && calls == 0);
+      empty.reset(nullptr, count, CountingAllocator<Counted>());
+    }
+    ASSERT_TRUE(calls == 2);
+    // while the default one skips nullptr
+    SharedPtr<Counted>(static_cast<Counted*>(nullptr));
+  }
+  {
+    {
+      UniquePtr<Counted[]> unique(new Counted[3]{1, 2, 3});
+      static_assert(sizeof(unique) == sizeof(Counted*));
+      ASSERT_TRUE(unique[0].value == 1 && unique[2].value == 3);
+      ASSERT_TRUE(Counted::alive == 3);
+      unique.reset(new Counted[2]{4, 5});
+      ASSERT_TRUE(unique[1].value == 5 && Counted::alive == 2);
+      UniquePtr<Counted[]> moved(std::move(unique));
+      ASSERT_TRUE(unique.get() == nullptr && moved[0].value == 4);
+    }
+    ASSERT_TRUE(Counted::alive == 0);
+
+    WeakPtr<Counted[]> weak;
+    {
+      SharedPtr<Counted[]> shared(new Counted[4]{1, 2, 3, 4});
+      SharedPtr<Counted[]> copy = shared;
+      weak = copy;
+      copy[3].value = 7;
+      ASSERT_TRUE(shared[3].value == 7 && shared.use_count() == 2);
+      ASSERT_TRUE(Counted::alive == 4 && weak.lock()[0].value == 1);
+    }
+    ASSERT_TRUE(Counted::alive == 0 && weak.expired());
+
+    auto zeros = MakeShared<int[]>(1000);
+    ASSERT_TRUE(zeros[0] == 0 && zeros[999] == 0);
+    auto sevens = MakeShared<long[]>(3, 7);
+    ASSERT_TRUE(sevens[0] == 7 && sevens[2] == 7);
+    auto empty = MakeShared<int[]>(0);
+    ASSERT_TRUE(empty.get() != nullptr && empty.use_count() == 1);
+
+    struct alignas(64) Line {
+      char bytes[64];
+    };
+    auto lines = MakeShared<Line[]>(2);
+    ASSERT_TRUE(reinterpret_cast<uintptr_t>(lines.get()) % 64 == 0);
+
+    using Counter = CountingAllocator<void>;
+    int allocations = Counter::allocations;
+    int deallocations = Counter::deallocations;
+    {
+      auto shared = AllocateShared<Counted[]>(CountingAllocator<Counted>(), 5,
+                                              Counted(9));
+      ASSERT_TRUE(Counter::allocations == allocations + 1);
+      ASSERT_TRUE(Counted::alive == 5 && shared[4].value == 9);
+    }
+    ASSERT_TRUE(Counted::alive == 0);
+    ASSERT_TRUE(Counter::deallocations == deallocations + 1);
+
+    // makes three elements and throws on the fourth one
+    struct Fuse {
+      int* left;
+      operator Counted() const {
+        if ((*left)-- == 0) {
+          throw std::runtime_error("constructor");
+        }
+        return Counted(1);
+      }
+    };
+    int left = 3;
+    bool thrown = false;
+    try {
+      AllocateShared<Counted[]>(CountingAllocator<Counted>(), 5, Fuse{&left});
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    ASSERT_TRUE(thrown && Counted::alive == 0);
+    ASSERT_TRUE(Counter::deallocations == deallocations + 2);
+  }
+  {
+    struct Link {
+      Counted counted;
+      SharedPtr<Link> next;
+    };
+    SharedPtr<Link> head;
+    for (int i = 0; i < 4; ++i) {
+      head = MakeShared<Link>(Link{Counted(i), head});
+    }
+    ASSERT_TRUE(Counted::alive == 4 && head->counted.value == 3);
+    // the old head owns the pointer it is replaced with
+    head = std::move(head->next);
+    ASSERT_TRUE(Counted::alive == 3 && head->counted.value == 2);
+    head = head->next;
+    ASSERT_TRUE(Counted::alive == 2 && head->counted.value == 1);
+    head.reset(std::move(head->next));
+    ASSERT_TRUE(Counted::alive == 1 && head->counted.value == 0);
+    head = std::move(head->next);
+    ASSERT_TRUE(Counted::alive == 0 && head.get() == nullptr);
+  }
+  {
+    SharedPtr<int> empty(nullptr);
+    ASSERT_TRUE(empty.get() == nullptr);
+    LocalSharedPtr<Counted> local(nullptr);
+    ASSERT_TRUE(local.get() == nullptr);
+  }
 }